@@ -24,6 +24,7 @@ pub fn build(b: *std.Build) void {
     };
     // If compiling for single target (default) single_exe will be set to the compile step for altairdsk.
     var single_exe: ?*std.Build.Step.Compile = null;
+    var single_lib: ?*std.Build.Step.Compile = null;
     const single_target = [_]std.Build.ResolvedTarget{b.standardTargetOptions(.{})};
 
     // Targets is list of targets we are building for.
@@ -35,6 +36,7 @@ pub fn build(b: *std.Build) void {
     const optimize = b.standardOptimizeOption(.{});
     const run_step = b.step("run", "Run the app");
     const test_step = b.step("test", "Run unit tests");
+    const bench_step = b.step("bench", "Run benchmarks");
 
     // For each target build the library and exe's
     for (targets) |target| {
@@ -59,6 +61,20 @@ pub fn build(b: *std.Build) void {
         });
         const zigcli = b.dependency("cli", .{});
         exe.root_module.addImport("zig-cli", zigcli.module("cli"));
+
+        // C interface to the library, for embedding in emulators. See include/altairdisk.h
+        const c_lib = b.addLibrary(.{
+            .name = "altairdisk",
+            .linkage = .dynamic,
+            .root_module = b.createModule(.{
+                .root_source_file = b.path("src/c_api.zig"),
+                .target = target,
+                .optimize = optimize,
+                .strip = strip_debug_symbols,
+            }),
+        });
+        c_lib.installHeader(b.path("include/altairdisk.h"), "altairdisk.h");
+
         if (targets.len > 1) {
             const install = b.addInstallArtifact(exe, .{
                 .dest_dir = .{ .override = .{
@@ -69,11 +85,26 @@ pub fn build(b: *std.Build) void {
                 } },
             });
             b.default_step.dependOn(&install.step);
+            // The header is the same for every target, so it is installed once below.
+            const install_lib = b.addInstallArtifact(c_lib, .{
+                .dest_dir = .{ .override = .{
+                    .custom = std.fmt.allocPrint(b.allocator, "lib/{s}-{s}", .{
+                        @tagName(target.result.cpu.arch),
+                        @tagName(target.result.os.tag),
+                    }) catch unreachable,
+                } },
+                .h_dir = .disabled,
+            });
+            b.default_step.dependOn(&install_lib.step);
         } else {
             single_exe = exe;
+            single_lib = c_lib;
             b.installArtifact(exe);
         }
     }
+    if (targets.len > 1) {
+        b.installFile("include/altairdisk.h", "include/altairdisk.h");
+    }
     if (single_exe) |exe| {
         // Add run and test commands, but only for sinlge arch builds.
         const target = single_target[0];
@@ -94,12 +125,26 @@ pub fn build(b: *std.Build) void {
 
         test_step.dependOn(&run_exe_unit_tests.step);
 
+        const bench_exe = b.addExecutable(.{
+            .name = "altairdsk-bench",
+            .root_module = b.createModule(.{
+                .root_source_file = b.path("src/bench.zig"),
+                .target = target,
+                .optimize = optimize,
+            }),
+        });
+        const run_bench = b.addRunArtifact(bench_exe);
+        bench_step.dependOn(&run_bench.step);
+        const c_lib = single_lib.?;
+
         // Don't output binary. Used for Zig "build on save" feature.
         // Which skips the LLVM emit so you can see buil errors more quickly.
         if (no_bin) {
             b.getInstallStep().dependOn(&exe.step);
+            b.getInstallStep().dependOn(&c_lib.step);
         } else {
             b.installArtifact(exe);
+            b.installArtifact(c_lib);
         }
     }
 }
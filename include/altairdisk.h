@@ -0,0 +1,146 @@
+/*
+ * C interface to the altair_disk library.
+ *
+ * Call altairdisk_init() once before anything else. Each open image can be used from any thread,
+ * and different images can be used from different threads at the same time. Calls on the same
+ * image from several threads are serialised.
+ *
+ * Functions that can fail return ALTAIRDISK_OK or one of the negative error codes below.
+ * Positive values mean the call succeeded with a warning, see ALTAIRDISK_AMBIGUOUS_TYPE.
+ * altairdisk_error_name() gives the underlying error of the last failed call on the calling thread.
+ *
+ * Files are read and written exactly as they are stored on the image, with no text conversion.
+ * Raw sectors are read straight into the caller's buffer. File contents are copied one sector
+ * at a time between the image and the caller's buffer, so the whole file is never buffered.
+ */
+#ifndef ALTAIRDISK_H
+#define ALTAIRDISK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ALTAIRDISK_OK 0
+/*
+ * Returned instead of ALTAIRDISK_OK when an image type was auto-detected, but the image could also be
+ * another type, e.g. HDD_5MB_1024 images are detected as HDD_5MB. The image is still opened.
+ * Pass the type name to use a different type.
+ */
+#define ALTAIRDISK_AMBIGUOUS_TYPE 1
+#define ALTAIRDISK_ERR_INVALID_ARGUMENT -1
+#define ALTAIRDISK_ERR_NOT_FOUND -2
+#define ALTAIRDISK_ERR_UNKNOWN_IMAGE -3
+#define ALTAIRDISK_ERR_BUFFER_TOO_SMALL -4
+#define ALTAIRDISK_ERR_EXISTS -5
+#define ALTAIRDISK_ERR_DISK_FULL -6
+#define ALTAIRDISK_ERR_READ_ONLY -7
+#define ALTAIRDISK_ERR_NO_MEMORY -8
+#define ALTAIRDISK_ERR_IO -9
+#define ALTAIRDISK_ERR_NOT_INITIALIZED -10
+
+/* Pass as `user` to match files of any user. Files are written to user 0. */
+#define ALTAIRDISK_ANY_USER -1
+
+/* Longest filename, not including the terminating NUL. */
+#define ALTAIRDISK_NAME_MAX 24
+
+typedef struct altairdisk_image altairdisk_image;
+
+typedef struct altairdisk_file_info {
+    char name[ALTAIRDISK_NAME_MAX + 1]; /* NUL terminated, e.g. "STAT.COM" */
+    uint8_t user;
+    uint8_t attribs[2];
+    uint32_t size; /* Bytes, as read by altairdisk_read_file(). Excludes the group map of Altair DOS random access files */
+} altairdisk_file_info;
+
+/* Set up the library. Returns ALTAIRDISK_OK if already set up. */
+int altairdisk_init(void);
+/* Release everything set up by altairdisk_init(). All images must be closed first. */
+void altairdisk_deinit(void);
+
+/* NUL terminated name of the error of the last failed call on this thread, e.g. "OutOfAllocs". */
+const char *altairdisk_error_name(void);
+
+/*
+ * Detect the type of the image at `path`. `*type_name` is set to a static string, e.g. "FDD_8IN".
+ * Returns ALTAIRDISK_AMBIGUOUS_TYPE if the image could also be another type.
+ */
+int altairdisk_detect(const char *path, const char **type_name);
+
+/*
+ * Open the image at `path`, with its directory loaded. `type_name` may be NULL to detect the type.
+ * Images are opened for writing if `writeable` is non-zero.
+ * Returns ALTAIRDISK_AMBIGUOUS_TYPE if the detected type could be wrong, in which case the image is open.
+ */
+int altairdisk_open(const char *path, const char *type_name, int writeable, altairdisk_image **image);
+/* Write back any changes and close the image. */
+int altairdisk_close(altairdisk_image *image);
+/* Write back any changes without closing the image. */
+int altairdisk_flush(altairdisk_image *image);
+
+/* Static type name of an open image. */
+const char *altairdisk_type_name(const altairdisk_image *image);
+uint16_t altairdisk_tracks(const altairdisk_image *image);
+uint16_t altairdisk_sectors_per_track(const altairdisk_image *image, uint16_t track);
+/* Size of a raw sector on `track`, including any header and checksum. e.g. 137 for MITS 8" disks. */
+size_t altairdisk_sector_size(const altairdisk_image *image, uint16_t track);
+
+/*
+ * Fill `files` with up to `capacity` entries for files of `user`.
+ * `*count` is set to the number of matching files, which may be more than `capacity`.
+ */
+int altairdisk_list(altairdisk_image *image, int user, altairdisk_file_info *files, size_t capacity, size_t *count);
+
+/*
+ * Read the file `name` into `buffer`. `*size` is set to the file size, as listed by altairdisk_list().
+ * Returns ALTAIRDISK_ERR_BUFFER_TOO_SMALL if it doesn't fit, with `*size` set to the size needed.
+ */
+int altairdisk_read_file(altairdisk_image *image, const char *name, int user, uint8_t *buffer, size_t capacity, size_t *size);
+/* Write `size` bytes from `data` to the file `name`. Replaces an existing file only if `force` is non-zero. */
+int altairdisk_write_file(altairdisk_image *image, const char *name, int user, const uint8_t *data, size_t size, int force);
+int altairdisk_erase_file(altairdisk_image *image, const char *name, int user);
+
+/*
+ * Read the raw sector at the unskewed `track` and `sector` into `buffer`, which must hold at least
+ * altairdisk_sector_size() bytes.
+ */
+int altairdisk_read_sector(altairdisk_image *image, uint16_t track, uint16_t sector, uint8_t *buffer, size_t capacity);
+/*
+ * Write exactly altairdisk_sector_size() bytes from `data` to the unskewed `track` and `sector`.
+ * Any sector checksum is recalculated.
+ */
+int altairdisk_write_sector(altairdisk_image *image, uint16_t track, uint16_t sector, const uint8_t *data, size_t size);
+
+/*
+ * Raw sector devices, for emulators. Sectors are served from a cache of whole tracks and written
+ * back to the image by a background thread. No checksums are calculated or checked, sectors are
+ * read and written exactly as the emulated controller sees them.
+ * Don't open the same image with altairdisk_open() while it is open as a device.
+ */
+typedef struct altairdisk_device altairdisk_device;
+
+/*
+ * Open the image at `path` for reading and writing as a device. `type_name` may be NULL to detect the type.
+ * If `skew` is non-zero, sectors are translated through the image's skew table like altairdisk_read_sector(),
+ * otherwise sector numbers are the order sectors are stored in each track of the image.
+ * `cached_tracks` may be 0 for the default of 16.
+ * Returns ALTAIRDISK_AMBIGUOUS_TYPE if the detected type could be wrong, in which case the device is open.
+ */
+int altairdisk_device_open(const char *path, const char *type_name, int skew, uint16_t cached_tracks, altairdisk_device **device);
+/* Write back all dirty tracks and close the device. */
+int altairdisk_device_close(altairdisk_device *device);
+/* Wait until all dirty tracks have been written back. Returns any error from writing them in the background. */
+int altairdisk_device_flush(altairdisk_device *device);
+size_t altairdisk_device_sector_size(altairdisk_device *device, uint16_t track);
+/* `size` must be exactly altairdisk_device_sector_size(). */
+int altairdisk_device_read_sector(altairdisk_device *device, uint16_t track, uint16_t sector, uint8_t *buffer, size_t size);
+int altairdisk_device_write_sector(altairdisk_device *device, uint16_t track, uint16_t sector, const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALTAIRDISK_H */
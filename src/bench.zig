@@ -0,0 +1,169 @@
+//! Benchmarks for the altair_disk library.
+//! Run with `zig build bench --release=fast`
+
+/// Number of files to put and then erase for each run.
+const bench_files = 24;
+const bench_image = "BENCH.DSK";
+
+pub fn main(init: std.process.Init) !void {
+    const io = init.io;
+    const gpa = init.gpa;
+
+    try benchInMemoryImage(io, gpa);
+    benchChecksum(io);
+    try benchSectorDevice(io, gpa);
+}
+
+const ImageMode = enum { on_disk, in_memory };
+
+/// Compare put / erase against the image file with the same against a LoadedImage.
+fn benchInMemoryImage(io: std.Io, gpa: std.mem.Allocator) !void {
+    const image_type = all_disk_types.getPtrConst(.FDD_8IN);
+    const cwd = std.Io.Dir.cwd();
+    const file = try cwd.createFile(io, bench_image, .{ .read = true });
+    defer {
+        file.close(io);
+        cwd.deleteFile(io, bench_image) catch {};
+    }
+
+    {
+        var reader = file.reader(io, &.{});
+        var writer = file.writer(io, &.{});
+        var image = try DiskImage.init(gpa, .{ .on_disk = &reader }, .{ .on_disk = &writer }, image_type);
+        defer image.deinit();
+        try image.formatImage();
+    }
+
+    std.debug.print("Put and erase {} files on {s}:\n", .{ bench_files, image_type.type_name });
+    inline for (std.meta.fields(ImageMode)) |field| {
+        const mode: ImageMode = @enumFromInt(field.value);
+        const elapsed_ns = try putEraseFiles(io, gpa, file, image_type, mode);
+        std.debug.print("  {s:<10} {d:>8.3}ms\n", .{ field.name, @as(f64, @floatFromInt(elapsed_ns)) / std.time.ns_per_ms });
+    }
+}
+
+fn putEraseFiles(io: std.Io, gpa: std.mem.Allocator, file: std.Io.File, image_type: *const DiskImageType, mode: ImageMode) !u64 {
+    const start = std.Io.Clock.awake.now(io);
+
+    var file_reader = file.reader(io, &.{});
+    var file_writer = file.writer(io, &.{});
+    var loaded: LoadedImage = undefined;
+    if (mode == .in_memory) try loaded.init(gpa, io, file, image_type);
+    defer if (mode == .in_memory) loaded.deinit(gpa);
+
+    var image = try DiskImage.init(
+        gpa,
+        if (mode == .in_memory) .{ .in_memory = &loaded.reader } else .{ .on_disk = &file_reader },
+        if (mode == .in_memory) .{ .in_memory = &loaded.writer } else .{ .on_disk = &file_writer },
+        image_type,
+    );
+    defer image.deinit();
+    try image.loadDirectories(.full);
+
+    const contents: [8 * 1024]u8 = @splat('B');
+    var name_buf: [16]u8 = undefined;
+    for (0..bench_files) |i| {
+        var contents_reader: std.Io.Reader = .fixed(&contents);
+        try image.copyToImage(&contents_reader, try std.fmt.bufPrint(&name_buf, "F{d}.BIN", .{i}), 0, false, .Binary);
+    }
+    for (0..bench_files) |i| {
+        const entry = image.directory.findByFilename(try std.fmt.bufPrint(&name_buf, "F{d}.BIN", .{i}), 0) orelse
+            return error.FileNotFound;
+        try image.erase(entry);
+    }
+    if (mode == .in_memory) _ = try loaded.writeBack(io, file);
+
+    const end = std.Io.Clock.awake.now(io);
+    return @intCast(end.nanoseconds - start.nanoseconds);
+}
+
+/// Number of 128 byte blocks summed for each checksum kernel.
+const checksum_blocks = 1024 * 1024;
+
+/// Compare the vector checksum kernel against the byte at a time version.
+fn benchChecksum(io: std.Io) void {
+    var blocks: [64][128]u8 = undefined;
+    var prng: std.Random.DefaultPrng = .init(0);
+    for (&blocks) |*block| prng.random().bytes(block);
+
+    std.debug.print("Checksum {} sectors:\n", .{checksum_blocks});
+    inline for (.{ "scalar", "vector" }, .{ DiskSector.sumBytesScalar, DiskSector.sumBytes }) |name, sumBytes| {
+        const start = std.Io.Clock.awake.now(io);
+        var total: u8 = 0;
+        for (0..checksum_blocks) |i| {
+            const block = &blocks[i % blocks.len];
+            std.mem.doNotOptimizeAway(block);
+            total +%= sumBytes(block);
+        }
+        std.mem.doNotOptimizeAway(total);
+        const end = std.Io.Clock.awake.now(io);
+        const elapsed_ns: u64 = @intCast(end.nanoseconds - start.nanoseconds);
+        std.debug.print("  {s:<10} {d:>8.3}ms\n", .{ name, @as(f64, @floatFromInt(elapsed_ns)) / std.time.ns_per_ms });
+    }
+}
+
+/// Number of random sectors read or written for each sector access method.
+const device_sectors = 1024 * 1024;
+
+const SectorAccess = enum { read_sector, device_read, device_read_unskewed, device_write };
+
+/// Time random sector access through DiskImage.readSector() and through a SectorDevice.
+fn benchSectorDevice(io: std.Io, gpa: std.mem.Allocator) !void {
+    const image_type = all_disk_types.getPtrConst(.FDD_8IN);
+    const cwd = std.Io.Dir.cwd();
+    const file = try cwd.createFile(io, bench_image, .{ .read = true });
+    defer {
+        file.close(io);
+        cwd.deleteFile(io, bench_image) catch {};
+    }
+
+    var reader = file.reader(io, &.{});
+    var writer = file.writer(io, &.{});
+    var image = try DiskImage.init(gpa, .{ .on_disk = &reader }, .{ .on_disk = &writer }, image_type);
+    defer image.deinit();
+    try image.formatImage();
+
+    std.debug.print("Access {} random sectors on {s}:\n", .{ device_sectors, image_type.type_name });
+    inline for (std.meta.fields(SectorAccess)) |field| {
+        const access: SectorAccess = @enumFromInt(field.value);
+        var device: SectorDevice = undefined;
+        // Cache every track, so once warm each access is a hit.
+        try device.init(io, gpa, file, image_type, .{ .cached_tracks = image_type.tracks, .skew = access != .device_read_unskewed });
+        defer device.deinit();
+
+        var prng: std.Random.DefaultPrng = .init(0);
+        const random = prng.random();
+        var sector: DiskSector = undefined;
+        var raw: [137]u8 = @splat(0xe5);
+        const start = std.Io.Clock.awake.now(io);
+        for (0..device_sectors) |_| {
+            const location: PhysicalAddress = .{
+                .track = random.uintLessThan(u16, image_type.tracks),
+                .sector = random.uintLessThan(u16, image_type.sectors_per_track),
+            };
+            switch (access) {
+                .read_sector => try image.readSector(location, &sector),
+                .device_read, .device_read_unskewed => try device.readSector(location, &raw),
+                .device_write => try device.writeSector(location, &raw),
+            }
+            std.mem.doNotOptimizeAway(&raw);
+        }
+        const end = std.Io.Clock.awake.now(io);
+        const elapsed_ns: u64 = @intCast(end.nanoseconds - start.nanoseconds);
+        std.debug.print("  {s:<22} {d:>8.1}ns/sector  ({d} track misses)\n", .{
+            field.name,
+            @as(f64, @floatFromInt(elapsed_ns)) / device_sectors,
+            device.stats.misses,
+        });
+    }
+}
+
+const std = @import("std");
+const disk_image = @import("disk_image.zig");
+const DiskImage = disk_image.DiskImage;
+const LoadedImage = disk_image.LoadedImage;
+const DiskImageType = @import("disk_types.zig").DiskImageType;
+const DiskSector = @import("disk_types.zig").DiskSector;
+const PhysicalAddress = @import("disk_types.zig").PhysicalAddress;
+const SectorDevice = @import("sector_device.zig");
+const all_disk_types = @import("disk_types.zig").all_disk_types;
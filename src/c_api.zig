@@ -0,0 +1,567 @@
+//! C interface to the library, built as libaltairdisk. See include/altairdisk.h
+//! Every exported function catches its errors and returns one of the ALTAIRDISK_ERR codes,
+//! recording the error name for altairdisk_error_name().
+//! Images are opened without a sector cache. Raw sectors are read straight into the caller's buffer,
+//! and file contents are copied one sector at a time into or out of the caller's buffer.
+
+const ok: c_int = 0;
+/// Success, but the detected image type can't be told apart from another type.
+const ok_ambiguous_type: c_int = 1;
+const err_invalid_argument: c_int = -1;
+const err_not_found: c_int = -2;
+const err_unknown_image: c_int = -3;
+const err_buffer_too_small: c_int = -4;
+const err_exists: c_int = -5;
+const err_disk_full: c_int = -6;
+const err_read_only: c_int = -7;
+const err_no_memory: c_int = -8;
+const err_io: c_int = -9;
+const err_not_initialized: c_int = -10;
+
+const any_user: c_int = -1;
+
+/// Matches altairdisk_file_info.
+pub const FileInfo = extern struct {
+    name: [CookedDirEntry.filename_max + 1]u8,
+    user: u8,
+    attribs: [2]u8,
+    size: u32,
+};
+
+/// The altairdisk_image handed to C callers.
+pub const Handle = opaque {};
+/// The altairdisk_device handed to C callers.
+pub const DeviceHandle = opaque {};
+
+const gpa = std.heap.smp_allocator;
+var threaded: std.Io.Threaded = undefined;
+var initialized = false;
+threadlocal var last_error: [:0]const u8 = "None";
+
+/// NUL terminated type names, for returning to C.
+const type_names_z = names: {
+    var names: [all_disk_type_names.len][:0]const u8 = undefined;
+    for (all_disk_type_names, 0..) |name, i| {
+        const name_z = name ++ "\x00";
+        names[i] = name_z[0..name.len :0];
+    }
+    const result = names;
+    break :names result;
+};
+
+/// An open image file, mapped into memory where possible, with its directory loaded.
+const Image = struct {
+    io: std.Io,
+    /// Held for the whole of every call on the image.
+    mutex: std.Io.Mutex,
+    file: std.Io.File,
+    file_reader: std.Io.File.Reader,
+    file_writer: std.Io.File.Writer,
+    mapped_image: MappedImage,
+    is_mapped: bool,
+    writeable: bool,
+    /// Set when raw sector writes may have changed the directory.
+    directory_stale: bool,
+    disk_image: DiskImage,
+    sector: DiskSector,
+
+    /// Returns true if the image type was detected, but could also be another type.
+    fn open(self: *Image, io: std.Io, path: []const u8, requested_type: ?[]const u8, writeable: bool) !bool {
+        self.io = io;
+        self.mutex = .init;
+        self.writeable = writeable;
+        self.directory_stale = false;
+        self.file = try std.Io.Dir.cwd().openFile(io, path, .{ .mode = if (writeable) .read_write else .read_only });
+        errdefer self.file.close(io);
+        const detected = try imageType(io, self.file, requested_type);
+        const image_type = detected.image_type;
+
+        self.file_reader = self.file.reader(io, &.{});
+        self.file_writer = self.file.writer(io, &.{});
+        self.is_mapped = false;
+        if (self.mapped_image.init(io, self.file, image_type, writeable)) {
+            self.is_mapped = true;
+        } else |err| {
+            log.info("Not memory mapping image: {t}", .{err});
+        }
+        errdefer if (self.is_mapped) self.mapped_image.deinit();
+
+        const reader: SeekableReader = if (self.is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_reader };
+        const writer: SeekableWriter = if (self.is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_writer };
+        self.disk_image = try DiskImage.init(gpa, reader, writer, image_type);
+        errdefer self.disk_image.deinit();
+        try self.disk_image.loadDirectories(.full);
+        return detected.ambiguous;
+    }
+
+    fn close(self: *Image) !void {
+        const result = self.flush();
+        self.disk_image.deinit();
+        if (self.is_mapped) self.mapped_image.deinit();
+        self.file.close(self.io);
+        return result;
+    }
+
+    fn flush(self: *Image) !void {
+        if (self.writeable) try self.disk_image.flush();
+    }
+
+    /// Reload the directory if raw sector writes may have changed it.
+    fn freshDirectory(self: *Image) !void {
+        if (!self.directory_stale) return;
+        const disk_image = &self.disk_image;
+        try disk_image.reuse(disk_image.reader, disk_image.writer, disk_image.image_type);
+        try disk_image.loadDirectories(.full);
+        self.directory_stale = false;
+    }
+
+    fn list(self: *Image, user: ?u8, files: []FileInfo, count: *usize) !void {
+        try self.freshDirectory();
+        count.* = 0;
+        for (self.disk_image.directory.cooked_directories.items) |*entry| {
+            if (user != null and entry.user != user.?) continue;
+            if (count.* < files.len) {
+                const info = &files[count.*];
+                const filename = entry.filenameAndExtension();
+                info.* = .{ .name = @splat(0), .user = entry.user, .attribs = entry.attribs, .size = entry.size_in_bytes };
+                @memcpy(info.name[0..filename.len], filename);
+            }
+            count.* += 1;
+        }
+    }
+
+    fn readFile(self: *Image, name: []const u8, user: ?u8, buffer: []u8, size: *usize) !void {
+        try self.freshDirectory();
+        const disk_image = &self.disk_image;
+        const entry = disk_image.directory.findByFilename(name, user) orelse return error.FileNotFound;
+        // In the exact text mode the copy is always the entry's size, so the size is known without reading the file.
+        const needed = try disk_image.copiedSize(entry, disk_image.exactTextMode());
+        if (needed > buffer.len) {
+            size.* = @intCast(needed);
+            return error.BufferTooSmall;
+        }
+        var writer: std.Io.Writer = .fixed(buffer);
+        try disk_image.copyFromImage(entry, &writer, disk_image.exactTextMode());
+        size.* = writer.end;
+    }
+
+    fn writeFile(self: *Image, name: []const u8, user: ?u8, data: []const u8, force: bool) !void {
+        if (!self.writeable) return error.ReadOnlyImage;
+        try self.freshDirectory();
+        const disk_image = &self.disk_image;
+        var reader: std.Io.Reader = .fixed(data);
+        try disk_image.copyToImageSized(&reader, data.len, name, user orelse 0, force, disk_image.exactTextMode());
+    }
+
+    fn eraseFile(self: *Image, name: []const u8, user: ?u8) !void {
+        if (!self.writeable) return error.ReadOnlyImage;
+        try self.freshDirectory();
+        const entry = self.disk_image.directory.findByFilename(name, user) orelse return error.FileNotFound;
+        try self.disk_image.erase(entry);
+    }
+
+    fn readSector(self: *Image, location: PhysicalAddress, buffer: []u8) !void {
+        const image_type = self.disk_image.image_type;
+        try location.validate(image_type);
+        const sector_size = image_type.sectorSizeRawForTrack(location.track);
+        if (buffer.len < sector_size) return error.BufferTooSmall;
+        try self.disk_image.reader.readAt(image_type.sectorOffset(location), buffer[0..sector_size]);
+    }
+
+    fn writeSector(self: *Image, location: PhysicalAddress, data: []const u8) !void {
+        if (!self.writeable) return error.ReadOnlyImage;
+        try location.validate(self.disk_image.image_type);
+        self.sector = .initUnformatted(self.disk_image.image_type, location.track);
+        if (data.len != self.sector.rawBytes().len) return error.InvalidSectorSize;
+        @memcpy(self.sector.rawBytes(), data);
+        try self.disk_image.writeSector(location, &self.sector);
+        // The sector may belong to the directory.
+        self.directory_stale = true;
+    }
+};
+
+export fn altairdisk_init() c_int {
+    if (initialized) return ok;
+    threaded = .init(gpa, .{});
+    initialized = true;
+    return ok;
+}
+
+export fn altairdisk_deinit() void {
+    if (!initialized) return;
+    threaded.deinit();
+    initialized = false;
+}
+
+export fn altairdisk_error_name() [*:0]const u8 {
+    return last_error;
+}
+
+export fn altairdisk_detect(path: ?[*:0]const u8, type_name: ?*[*:0]const u8) c_int {
+    if (!initialized) return fail(error.NotInitialized);
+    const path_z = path orelse return fail(error.InvalidArgument);
+    const type_name_out = type_name orelse return fail(error.InvalidArgument);
+    const io = threaded.io();
+    const file = std.Io.Dir.cwd().openFile(io, std.mem.span(path_z), .{ .mode = .read_only }) catch |err| return fail(err);
+    defer file.close(io);
+    const detected = imageType(io, file, null) catch |err| return fail(err);
+    type_name_out.* = typeNameZ(detected.image_type);
+    return if (detected.ambiguous) ok_ambiguous_type else ok;
+}
+
+export fn altairdisk_open(path: ?[*:0]const u8, type_name: ?[*:0]const u8, writeable: c_int, image: ?*?*Handle) c_int {
+    if (!initialized) return fail(error.NotInitialized);
+    const path_z = path orelse return fail(error.InvalidArgument);
+    const image_out = image orelse return fail(error.InvalidArgument);
+    const self = gpa.create(Image) catch |err| return fail(err);
+    const requested_type = if (type_name) |name| std.mem.span(name) else null;
+    const ambiguous = self.open(threaded.io(), std.mem.span(path_z), requested_type, writeable != 0) catch |err| {
+        gpa.destroy(self);
+        return fail(err);
+    };
+    image_out.* = @ptrCast(self);
+    return if (ambiguous) ok_ambiguous_type else ok;
+}
+
+export fn altairdisk_close(image: ?*Handle) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    defer gpa.destroy(self);
+    return status(self.close());
+}
+
+export fn altairdisk_flush(image: ?*Handle) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    return status(self.flush());
+}
+
+export fn altairdisk_type_name(image: ?*const Handle) [*:0]const u8 {
+    const self = fromConstHandle(image) orelse return "";
+    return typeNameZ(self.disk_image.image_type);
+}
+
+export fn altairdisk_tracks(image: ?*const Handle) u16 {
+    const self = fromConstHandle(image) orelse return 0;
+    return self.disk_image.image_type.tracks;
+}
+
+export fn altairdisk_sectors_per_track(image: ?*const Handle, track: u16) u16 {
+    const self = fromConstHandle(image) orelse return 0;
+    return self.disk_image.image_type.sectorsForTrack(track);
+}
+
+export fn altairdisk_sector_size(image: ?*const Handle, track: u16) usize {
+    const self = fromConstHandle(image) orelse return 0;
+    return self.disk_image.image_type.sectorSizeRawForTrack(track);
+}
+
+export fn altairdisk_list(image: ?*Handle, user: c_int, files: ?[*]FileInfo, capacity: usize, count: ?*usize) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const count_out = count orelse return fail(error.InvalidArgument);
+    const user_filter = userFromC(user) catch |err| return fail(err);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    const files_slice: []FileInfo = if (files) |f| f[0..capacity] else &.{};
+    return status(self.list(user_filter, files_slice, count_out));
+}
+
+export fn altairdisk_read_file(image: ?*Handle, name: ?[*:0]const u8, user: c_int, buffer: ?[*]u8, capacity: usize, size: ?*usize) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const name_z = name orelse return fail(error.InvalidArgument);
+    const size_out = size orelse return fail(error.InvalidArgument);
+    const user_filter = userFromC(user) catch |err| return fail(err);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    const buffer_slice: []u8 = if (buffer) |b| b[0..capacity] else &.{};
+    return status(self.readFile(std.mem.span(name_z), user_filter, buffer_slice, size_out));
+}
+
+export fn altairdisk_write_file(image: ?*Handle, name: ?[*:0]const u8, user: c_int, data: ?[*]const u8, size: usize, force: c_int) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const name_z = name orelse return fail(error.InvalidArgument);
+    const user_filter = userFromC(user) catch |err| return fail(err);
+    if (data == null and size != 0) return fail(error.InvalidArgument);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    const data_slice: []const u8 = if (data) |d| d[0..size] else &.{};
+    return status(self.writeFile(std.mem.span(name_z), user_filter, data_slice, force != 0));
+}
+
+export fn altairdisk_erase_file(image: ?*Handle, name: ?[*:0]const u8, user: c_int) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const name_z = name orelse return fail(error.InvalidArgument);
+    const user_filter = userFromC(user) catch |err| return fail(err);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    return status(self.eraseFile(std.mem.span(name_z), user_filter));
+}
+
+export fn altairdisk_read_sector(image: ?*Handle, track: u16, sector: u16, buffer: ?[*]u8, capacity: usize) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const buffer_ptr = buffer orelse return fail(error.InvalidArgument);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    return status(self.readSector(.{ .track = track, .sector = sector }, buffer_ptr[0..capacity]));
+}
+
+export fn altairdisk_write_sector(image: ?*Handle, track: u16, sector: u16, data: ?[*]const u8, size: usize) c_int {
+    const self = fromHandle(image) orelse return fail(error.InvalidArgument);
+    const data_ptr = data orelse return fail(error.InvalidArgument);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    return status(self.writeSector(.{ .track = track, .sector = sector }, data_ptr[0..size]));
+}
+
+/// An image file opened as a SectorDevice.
+const Device = struct {
+    io: std.Io,
+    file: std.Io.File,
+    device: SectorDevice,
+
+    /// Returns true if the image type was detected, but could also be another type.
+    fn open(self: *Device, io: std.Io, path: []const u8, requested_type: ?[]const u8, options: SectorDevice.Options) !bool {
+        self.io = io;
+        self.file = try std.Io.Dir.cwd().openFile(io, path, .{ .mode = .read_write });
+        errdefer self.file.close(io);
+        const detected = try imageType(io, self.file, requested_type);
+        try self.device.init(io, gpa, self.file, detected.image_type, options);
+        return detected.ambiguous;
+    }
+
+    fn close(self: *Device) !void {
+        const result = self.device.flush();
+        self.device.deinit();
+        self.file.close(self.io);
+        return result;
+    }
+};
+
+export fn altairdisk_device_open(path: ?[*:0]const u8, type_name: ?[*:0]const u8, skew: c_int, cached_tracks: u16, device: ?*?*DeviceHandle) c_int {
+    if (!initialized) return fail(error.NotInitialized);
+    const path_z = path orelse return fail(error.InvalidArgument);
+    const device_out = device orelse return fail(error.InvalidArgument);
+    const self = gpa.create(Device) catch |err| return fail(err);
+    const requested_type = if (type_name) |name| std.mem.span(name) else null;
+    const options: SectorDevice.Options = .{
+        .cached_tracks = if (cached_tracks == 0) SectorDevice.default_cached_tracks else cached_tracks,
+        .skew = skew != 0,
+    };
+    const ambiguous = self.open(threaded.io(), std.mem.span(path_z), requested_type, options) catch |err| {
+        gpa.destroy(self);
+        return fail(err);
+    };
+    device_out.* = @ptrCast(self);
+    return if (ambiguous) ok_ambiguous_type else ok;
+}
+
+export fn altairdisk_device_close(device: ?*DeviceHandle) c_int {
+    const self = fromDeviceHandle(device) orelse return fail(error.InvalidArgument);
+    defer gpa.destroy(self);
+    return status(self.close());
+}
+
+export fn altairdisk_device_flush(device: ?*DeviceHandle) c_int {
+    const self = fromDeviceHandle(device) orelse return fail(error.InvalidArgument);
+    return status(self.device.flush());
+}
+
+export fn altairdisk_device_sector_size(device: ?*DeviceHandle, track: u16) usize {
+    const self = fromDeviceHandle(device) orelse return 0;
+    return self.device.sectorSize(track);
+}
+
+export fn altairdisk_device_read_sector(device: ?*DeviceHandle, track: u16, sector: u16, buffer: ?[*]u8, size: usize) c_int {
+    const self = fromDeviceHandle(device) orelse return fail(error.InvalidArgument);
+    const buffer_ptr = buffer orelse return fail(error.InvalidArgument);
+    return status(self.device.readSector(.{ .track = track, .sector = sector }, buffer_ptr[0..size]));
+}
+
+export fn altairdisk_device_write_sector(device: ?*DeviceHandle, track: u16, sector: u16, data: ?[*]const u8, size: usize) c_int {
+    const self = fromDeviceHandle(device) orelse return fail(error.InvalidArgument);
+    const data_ptr = data orelse return fail(error.InvalidArgument);
+    return status(self.device.writeSector(.{ .track = track, .sector = sector }, data_ptr[0..size]));
+}
+
+fn fromDeviceHandle(handle: ?*DeviceHandle) ?*Device {
+    return @ptrCast(@alignCast(handle orelse return null));
+}
+
+fn fromHandle(handle: ?*Handle) ?*Image {
+    return @ptrCast(@alignCast(handle orelse return null));
+}
+
+fn fromConstHandle(handle: ?*const Handle) ?*const Image {
+    return @ptrCast(@alignCast(handle orelse return null));
+}
+
+const DetectedType = struct {
+    image_type: *const DiskImageType,
+    /// Detected, but can't be told apart from another type. e.g. HDD_5MB and HDD_5MB_1024
+    ambiguous: bool,
+};
+
+/// The requested image type, otherwise the detected type of `file`.
+fn imageType(io: std.Io, file: std.Io.File, requested_type: ?[]const u8) error{ UnknownImageType, CantDetectImage }!DetectedType {
+    if (requested_type) |type_name| return .{ .image_type = try findImageType(type_name), .ambiguous = false };
+    var unique = false;
+    const image_type = DiskImage.detectImageType(io, file, &unique) orelse return error.CantDetectImage;
+    return .{ .image_type = image_type, .ambiguous = !unique };
+}
+
+fn findImageType(type_name: []const u8) error{UnknownImageType}!*const DiskImageType {
+    for (std.enums.values(DiskImageTypes)) |type_id| {
+        const image_type = all_disk_types.getPtrConst(type_id);
+        if (std.ascii.eqlIgnoreCase(image_type.type_name, type_name)) return image_type;
+    }
+    return error.UnknownImageType;
+}
+
+fn typeNameZ(image_type: *const DiskImageType) [*:0]const u8 {
+    return type_names_z[@intFromEnum(image_type.type_id)];
+}
+
+fn userFromC(user: c_int) error{InvalidUser}!?u8 {
+    if (user == any_user) return null;
+    return std.math.cast(u8, user) orelse error.InvalidUser;
+}
+
+fn status(result: anyerror!void) c_int {
+    result catch |err| return fail(err);
+    return ok;
+}
+
+/// Record `err` for altairdisk_error_name() and return its error code.
+fn fail(err: anyerror) c_int {
+    last_error = @errorName(err);
+    return switch (err) {
+        error.InvalidArgument,
+        error.InvalidUser,
+        error.InvalidTrack,
+        error.InvalidSector,
+        error.InvalidSectorSize,
+        error.InvalidFilename,
+        error.UnknownImageType,
+        => err_invalid_argument,
+        error.FileNotFound, error.CookedDirEntryNotFound => err_not_found,
+        error.CantDetectImage, error.InvalidImageFile => err_unknown_image,
+        error.BufferTooSmall => err_buffer_too_small,
+        error.PathAlreadyExists => err_exists,
+        error.OutOfAllocs, error.OutOfExtents => err_disk_full,
+        error.ReadOnlyImage, error.ReadOnlySupport, error.AccessDenied => err_read_only,
+        error.OutOfMemory => err_no_memory,
+        error.NotInitialized => err_not_initialized,
+        else => err_io,
+    };
+}
+
+test "C interface" {
+    const io = std.testing.io;
+    const path = "TEST_CAPI.DSK";
+    const image_type = all_disk_types.getPtrConst(.FDD_8IN);
+    {
+        const file = try std.Io.Dir.cwd().createFile(io, path, .{ .read = true });
+        defer file.close(io);
+        var file_reader = file.reader(io, &.{});
+        var file_writer = file.writer(io, &.{});
+        var disk_image = try DiskImage.init(std.testing.allocator, .{ .on_disk = &file_reader }, .{ .on_disk = &file_writer }, image_type);
+        defer disk_image.deinit();
+        try disk_image.formatImage();
+    }
+    defer std.Io.Dir.cwd().deleteFile(io, path) catch {};
+
+    try std.testing.expectEqual(ok, altairdisk_init());
+    defer altairdisk_deinit();
+
+    var type_name: [*:0]const u8 = undefined;
+    try std.testing.expectEqual(ok, altairdisk_detect(path, &type_name));
+    try std.testing.expectEqualStrings("FDD_8IN", std.mem.span(type_name));
+
+    var image: ?*Handle = null;
+    try std.testing.expectEqual(ok, altairdisk_open(path, null, 1, &image));
+
+    const contents: [300]u8 = @splat('X');
+    try std.testing.expectEqual(ok, altairdisk_write_file(image, "TEST.TXT", 0, &contents, contents.len, 0));
+    try std.testing.expectEqual(err_exists, altairdisk_write_file(image, "TEST.TXT", 0, &contents, contents.len, 0));
+    try std.testing.expectEqualStrings("PathAlreadyExists", std.mem.span(altairdisk_error_name()));
+
+    var files: [4]FileInfo = undefined;
+    var count: usize = 0;
+    try std.testing.expectEqual(ok, altairdisk_list(image, any_user, &files, files.len, &count));
+    try std.testing.expectEqual(1, count);
+    try std.testing.expectEqualStrings("TEST.TXT", std.mem.sliceTo(&files[0].name, 0));
+
+    // CP/M pads the last record.
+    var buffer: [512]u8 = undefined;
+    var size: usize = 0;
+    try std.testing.expectEqual(err_buffer_too_small, altairdisk_read_file(image, "TEST.TXT", 0, &buffer, 100, &size));
+    try std.testing.expectEqual(384, size);
+    try std.testing.expectEqual(ok, altairdisk_read_file(image, "TEST.TXT", 0, &buffer, buffer.len, &size));
+    try std.testing.expectEqualSlices(u8, &contents, buffer[0..contents.len]);
+
+    const sector_size = altairdisk_sector_size(image, 2);
+    try std.testing.expectEqual(137, sector_size);
+    try std.testing.expectEqual(ok, altairdisk_read_sector(image, 2, 0, &buffer, buffer.len));
+    try std.testing.expectEqual(ok, altairdisk_write_sector(image, 2, 0, &buffer, sector_size));
+    try std.testing.expectEqual(err_invalid_argument, altairdisk_read_sector(image, image_type.tracks, 0, &buffer, buffer.len));
+
+    try std.testing.expectEqual(ok, altairdisk_erase_file(image, "TEST.TXT", any_user));
+    try std.testing.expectEqual(err_not_found, altairdisk_read_file(image, "TEST.TXT", 0, &buffer, buffer.len, &size));
+    try std.testing.expectEqual(ok, altairdisk_close(image));
+
+    var device: ?*DeviceHandle = null;
+    try std.testing.expectEqual(ok, altairdisk_device_open(path, "FDD_8IN", 1, 0, &device));
+    try std.testing.expectEqual(137, altairdisk_device_sector_size(device, 2));
+    const raw: [137]u8 = @splat(0x55);
+    try std.testing.expectEqual(ok, altairdisk_device_write_sector(device, 2, 0, &raw, raw.len));
+    try std.testing.expectEqual(err_invalid_argument, altairdisk_device_write_sector(device, 2, 0, &raw, 128));
+    try std.testing.expectEqual(ok, altairdisk_device_flush(device));
+    try std.testing.expectEqual(ok, altairdisk_device_read_sector(device, 2, 0, &buffer, raw.len));
+    try std.testing.expectEqualSlices(u8, &raw, buffer[0..raw.len]);
+    try std.testing.expectEqual(ok, altairdisk_device_close(device));
+}
+
+test "C interface ambiguous image type" {
+    const io = std.testing.io;
+    const path = "TEST_CAPI_HDD.DSK";
+    {
+        const file = try std.Io.Dir.cwd().createFile(io, path, .{ .read = true });
+        defer file.close(io);
+        var file_reader = file.reader(io, &.{});
+        var file_writer = file.writer(io, &.{});
+        var disk_image = try DiskImage.init(std.testing.allocator, .{ .on_disk = &file_reader }, .{ .on_disk = &file_writer }, all_disk_types.getPtrConst(.HDD_5MB));
+        defer disk_image.deinit();
+        try disk_image.formatImage();
+    }
+    defer std.Io.Dir.cwd().deleteFile(io, path) catch {};
+
+    try std.testing.expectEqual(ok, altairdisk_init());
+    defer altairdisk_deinit();
+
+    var type_name: [*:0]const u8 = undefined;
+    try std.testing.expectEqual(ok_ambiguous_type, altairdisk_detect(path, &type_name));
+    try std.testing.expectEqualStrings("HDD_5MB", std.mem.span(type_name));
+
+    var image: ?*Handle = null;
+    try std.testing.expectEqual(ok_ambiguous_type, altairdisk_open(path, null, 0, &image));
+    try std.testing.expectEqual(ok, altairdisk_close(image));
+    try std.testing.expectEqual(ok, altairdisk_open(path, "HDD_5MB", 0, &image));
+    try std.testing.expectEqual(ok, altairdisk_close(image));
+}
+
+const std = @import("std");
+const log = std.log.scoped(.altair_disk_lib);
+const di = @import("disk_image.zig");
+const DiskImage = di.DiskImage;
+const MappedImage = di.MappedImage;
+const SeekableReader = di.SeekableReader;
+const SeekableWriter = di.SeekableWriter;
+const disk_types = @import("disk_types.zig");
+const DiskImageType = disk_types.DiskImageType;
+const DiskImageTypes = disk_types.DiskImageTypes;
+const DiskSector = disk_types.DiskSector;
+const PhysicalAddress = disk_types.PhysicalAddress;
+const all_disk_types = disk_types.all_disk_types;
+const all_disk_type_names = disk_types.all_disk_type_names;
+const CookedDirEntry = @import("directory_table.zig").CookedDirEntry;
+const SectorDevice = @import("sector_device.zig");
@@ -36,6 +36,14 @@ const command_list = [_]Command{
     .{ .option = "do_information", .name = "image information", .write = false, .action = printImageInfo },
     .{ .option = "do_label_set", .name = "set disk label", .write = true, .action = labelSet },
     .{ .option = "do_label_get", .name = "show disk label", .write = false, .action = labelShow },
+    .{ .option = "do_batch", .name = "batch", .write = true, .action = runBatch },
+    .{ .option = "do_export_tar", .name = "export tar", .write = false, .action = exportTar },
+    .{ .option = "do_import_tar", .name = "import tar", .write = true, .action = importTar },
+    .{ .option = "do_transfer", .name = "transfer files", .write = false, .action = transferFiles },
+    .{ .option = "do_diff", .name = "diff images", .write = false, .action = diffImages },
+    .{ .option = "do_hash", .name = "hash files", .write = false, .action = hashFiles },
+    .{ .option = "do_defragment", .name = "defragment", .write = true, .action = defragmentImage },
+    .{ .option = "do_sync", .name = "sync directory", .write = true, .action = syncDirectory },
 };
 
 var current_command: []const u8 = undefined;
@@ -47,6 +55,11 @@ const Context = struct {
 
 /// Dispatch the correct command based on the supplied command line options.
 pub fn dispatch(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions) CommandError!void {
+    // Inventory works on a directory of images rather than a single image.
+    if (options.do_inventory) return inventory(io, gpa, options);
+    // The server opens images as they are requested.
+    if (options.do_serve) return serve(io, gpa, options);
+
     var write_access: bool = undefined;
     // Create a table that sets write_access and last_command_description
     // based on which do_xxxx flag is true in the options struct
@@ -112,9 +125,46 @@ pub fn dispatch(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions)
     var image_reader = file.reader(io, &.{});
     var image_writer = file.writer(io, &.{});
 
+    // Optionally work on a copy of the whole image in memory, and only write back the changes.
+    const is_loaded = options.in_memory and !options.do_format;
+    var loaded_image: LoadedImage = undefined;
+    if (is_loaded) {
+        errdefer file.close(io);
+        loaded_image.init(gpa, io, file, image_type) catch |err| {
+            printErrorMessage(current_command, .image_load, .{}, err);
+            return error.CommandFailed;
+        };
+    }
+    defer if (is_loaded) loaded_image.deinit(gpa);
+
+    // Map existing images into memory where possible, so sector access doesn't
+    // need a syscall per sector. Fall back to file access if it can't be mapped.
+    var mapped_image: MappedImage = undefined;
+    var is_mapped = false;
+    if (!is_loaded and !options.do_format and !options.no_mmap) {
+        if (mapped_image.init(io, file, image_type, write_access)) {
+            is_mapped = true;
+        } else |err| {
+            log.info("Not memory mapping image: {t}", .{err});
+        }
+    }
+    defer if (is_mapped) mapped_image.deinit();
+
     var disk_image = disk_image: {
         errdefer file.close(io);
-        break :disk_image DiskImage.init(gpa, .{ .on_disk = &image_reader }, .{ .on_disk = &image_writer }, image_type) catch |err| {
+        const reader: SeekableReader = if (is_loaded)
+            .{ .in_memory = &loaded_image.reader }
+        else if (is_mapped)
+            .{ .mapped = &mapped_image }
+        else
+            .{ .on_disk = &image_reader };
+        const writer: SeekableWriter = if (is_loaded)
+            .{ .in_memory = &loaded_image.writer }
+        else if (is_mapped)
+            .{ .mapped = &mapped_image }
+        else
+            .{ .on_disk = &image_writer };
+        break :disk_image DiskImage.init(gpa, reader, writer, image_type) catch |err| {
             printErrorMessage(current_command, .image_init, .{options.image_file}, err);
             return error.CommandFailed;
         };
@@ -122,6 +172,12 @@ pub fn dispatch(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions)
     defer disk_image.deinit();
     defer file.close(io);
 
+    disk_image.enableSectorCache(SectorCache.default_capacity) catch |err| {
+        printErrorMessage(current_command, .image_init, .{options.image_file}, err);
+        return error.CommandFailed;
+    };
+    disk_image.verify_checksums = options.verify;
+
     if (!options.do_format and !options.do_recover and !options.do_information) {
         disk_image.loadDirectories(if (options.do_raw_dir) .raw_only else .full) catch |err| {
             printErrorMessage(current_command, .image_load, .{}, err);
@@ -135,7 +191,30 @@ pub fn dispatch(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions)
         // If there is a field in options with the same name as command.option
         if (@field(options, command.option)) {
             defer Console.flushOut() catch {};
+            defer {
+                if (command.write) disk_image.flush() catch |err| {
+                    printErrorMessage(current_command, .unexpected, .{}, err);
+                };
+                if (disk_image.sectorCacheStats()) |stats| {
+                    log.info("Sector cache: {} hits, {} misses, {} writebacks", .{ stats.hits, stats.misses, stats.writebacks });
+                }
+                if (disk_image.checksum_errors > 0) {
+                    log.warn("{} sectors read with bad checksums", .{disk_image.checksum_errors});
+                }
+            }
             try command.action(.{ .io = io, .gpa = gpa }, &disk_image, options);
+            // Only write back an in memory image if the command succeeded.
+            if (is_loaded and command.write) {
+                disk_image.flush() catch |err| {
+                    printErrorMessage(current_command, .unexpected, .{}, err);
+                    return error.CommandFailed;
+                };
+                const nbytes = loaded_image.writeBack(io, file) catch |err| {
+                    printErrorMessage(current_command, .file_write, .{options.image_file}, err);
+                    return error.CommandFailed;
+                };
+                log.info("Wrote back {} modified bytes to {s}", .{ nbytes, options.image_file });
+            }
             return;
         }
     }
@@ -143,6 +222,28 @@ pub fn dispatch(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions)
     unreachable;
 }
 
+/// List the files on every image in the directory tree given as the image filename.
+fn inventory(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions) CommandError!void {
+    current_command = "inventory";
+    const stats = Inventory.run(io, gpa, options.image_file, options.jobs, options.do_hash, options.quiet) catch |err| {
+        printErrorMessage(current_command, .open_directory, .{options.image_file}, err);
+        return error.CommandFailed;
+    };
+    log.info("Listed {} files on {} images. {} files skipped", .{ stats.files, stats.images, stats.failed });
+    if (stats.failed > 0) {
+        return error.CommandFailedCanContinue;
+    }
+}
+
+/// Serve images over the Unix domain socket given as the image filename, until the process is stopped.
+fn serve(io: std.Io, gpa: std.mem.Allocator, options: CommandLineOptions) CommandError!void {
+    current_command = "serve";
+    ImageServer.run(io, gpa, options.image_file, ImageServer.default_pool_size, ImageServer.default_max_connections) catch |err| {
+        printErrorMessage(current_command, .open_socket, .{options.image_file}, err);
+        return error.CommandFailed;
+    };
+}
+
 /// Do a standard directory listing.
 pub fn directoryList(_: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     var file_count: u32 = 0;
@@ -365,20 +466,18 @@ pub fn getFile(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions
 }
 
 /// Get multiple files from the image.
+/// Files are copied in parallel, see --jobs.
 pub fn getFileMultiple(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     var had_error = false;
+    var entries: std.ArrayList(*const CookedDirEntry) = .empty;
+    defer entries.deinit(ctx.gpa);
     for (options.multiple_files) |file_pattern| {
         var found_file: bool = false;
         var itr = disk_image.directory.findByFileNameWildcards(file_pattern, options.cpm_user);
 
         while (itr.next()) |entry| {
             found_file = true;
-            _getFile(ctx, disk_image, .{ .dir_entry = entry }, options) catch |err| {
-                return switch (err) {
-                    error.CommandFailedCanContinue => continue,
-                    else => error.CommandFailed,
-                };
-            };
+            entries.append(ctx.gpa, entry) catch OOM();
         } else {
             if (!found_file) {
                 had_error = true;
@@ -386,11 +485,62 @@ pub fn getFileMultiple(ctx: Context, disk_image: *DiskImage, options: CommandLin
             }
         }
     }
+
+    var get: ParallelGet = .{ .ctx = ctx, .disk_image = disk_image, .options = options, .entries = entries.items };
+    const workers = ctx.gpa.alloc(ParallelGet.Worker, Workers.count(options.jobs, entries.items.len)) catch OOM();
+    defer ctx.gpa.free(workers);
+
+    // Only reads without a sector cache are thread safe.
+    const had_cache = disk_image.cache != null;
+    if (workers.len > 1 and had_cache) {
+        disk_image.disableSectorCache() catch |err| {
+            printErrorMessage(current_command, .unexpected, .{}, err);
+            return error.CommandFailed;
+        };
+    }
+    defer if (workers.len > 1 and had_cache) disk_image.enableSectorCache(SectorCache.default_capacity) catch OOM();
+    for (workers) |*worker| worker.* = .{ .get = &get };
+    Workers.runAll(ctx.gpa, ParallelGet.Worker, workers) catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+        return error.CommandFailed;
+    };
+
+    if (get.failed.load(.monotonic)) {
+        return error.CommandFailed;
+    }
     if (had_error) {
         return error.CommandFailed;
     }
 }
 
+/// Files being copied from the image by getFileMultiple()
+const ParallelGet = struct {
+    ctx: Context,
+    disk_image: *DiskImage,
+    options: CommandLineOptions,
+    entries: []const *const CookedDirEntry,
+    /// Index of the next entry to copy.
+    next_entry: std.atomic.Value(usize) = .init(0),
+    /// Set when a copy fails in a way that should stop all the other copies.
+    failed: std.atomic.Value(bool) = .init(false),
+
+    const Worker = struct {
+        get: *ParallelGet,
+
+        fn run(self: *Worker) void {
+            const get = self.get;
+            while (!get.failed.load(.monotonic)) {
+                const i = get.next_entry.fetchAdd(1, .monotonic);
+                if (i >= get.entries.len) return;
+                _getFile(get.ctx, get.disk_image, .{ .dir_entry = get.entries[i] }, get.options) catch |err| switch (err) {
+                    error.CommandFailedCanContinue => continue,
+                    else => get.failed.store(true, .monotonic),
+                };
+            }
+        }
+    };
+};
+
 pub const FileNameOrCookedDir = union(enum) {
     filename: []const u8,
     dir_entry: *const CookedDirEntry,
@@ -456,17 +606,7 @@ fn _getFile(ctx: Context, disk_image: *DiskImage, lookup: FileNameOrCookedDir, o
     };
     defer out_file.close(ctx.io);
 
-    var text_mode: DiskImage.TextMode = .Auto;
-    if (options.text_mode) { // FUTURE TODO: Change this to work as an enum option.. three options is just too much?
-        // We should also restrict to the OS it applies to... maybe twe add a "BASIC" enum instead of abusing Ascii?
-        text_mode = .Text;
-    } else if (options.bin_mode) {
-        text_mode = .Binary;
-    } else if (options.rand_mode) {
-        text_mode = .Rand;
-    } else if (options.basic_mode) {
-        text_mode = .BASIC;
-    }
+    const text_mode = getTextMode(options);
 
     var write_buffer: [4096]u8 = undefined;
     var file_writer = out_file.writer(ctx.io, &write_buffer);
@@ -491,16 +631,201 @@ fn _getFile(ctx: Context, disk_image: *DiskImage, lookup: FileNameOrCookedDir, o
     log.info("Copied file {s} to {s}", .{ dir_entry.filenameAndExtension(), out_filename });
 }
 
+/// Text mode for copying files from the image.
+fn getTextMode(options: CommandLineOptions) DiskImage.TextMode {
+    // FUTURE TODO: Change this to work as an enum option.. three options is just too much?
+    // We should also restrict to the OS it applies to... maybe twe add a "BASIC" enum instead of abusing Ascii?
+    if (options.text_mode) return .Text;
+    if (options.bin_mode) return .Binary;
+    if (options.rand_mode) return .Rand;
+    if (options.basic_mode) return .BASIC;
+    return .Auto;
+}
+
+/// Print the hash, size and name of every file (or those matching the filenames given) on the image.
+/// Files are hashed as they are stored, in parallel (see --jobs), and listed in directory order.
+pub fn hashFiles(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    var had_error = false;
+    var entries: std.ArrayList(*const CookedDirEntry) = .empty;
+    defer entries.deinit(ctx.gpa);
+    const all_files = [_][]const u8{"*"};
+    const patterns = if (options.multiple_files.len == 0) &all_files else options.multiple_files;
+    for (patterns) |file_pattern| {
+        var found_file = false;
+        var itr = disk_image.directory.findByFileNameWildcards(file_pattern, options.cpm_user);
+        while (itr.next()) |entry| {
+            found_file = true;
+            entries.append(ctx.gpa, entry) catch OOM();
+        }
+        // An empty image has nothing to hash, which isn't an error.
+        if (!found_file and options.multiple_files.len != 0) {
+            had_error = true;
+            printErrorMessage(current_command, .no_matching_files, .{file_pattern}, error.None);
+        }
+    }
+
+    const digests = ctx.gpa.alloc(FileHash.HashError!FileHash.Digest, entries.items.len) catch OOM();
+    defer ctx.gpa.free(digests);
+    var hash: ParallelHash = .{ .disk_image = disk_image, .entries = entries.items, .digests = digests };
+    const workers = ctx.gpa.alloc(ParallelHash.Worker, Workers.count(options.jobs, entries.items.len)) catch OOM();
+    defer ctx.gpa.free(workers);
+
+    // Only reads without a sector cache are thread safe.
+    const had_cache = disk_image.cache != null;
+    if (workers.len > 1 and had_cache) {
+        disk_image.disableSectorCache() catch |err| {
+            printErrorMessage(current_command, .unexpected, .{}, err);
+            return error.CommandFailed;
+        };
+    }
+    defer if (workers.len > 1 and had_cache) disk_image.enableSectorCache(SectorCache.default_capacity) catch OOM();
+    for (workers) |*worker| worker.* = .{ .hash = &hash };
+    Workers.runAll(ctx.gpa, ParallelHash.Worker, workers) catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+        return error.CommandFailed;
+    };
+
+    const stdout = Console.stdout();
+    for (entries.items, digests) |entry, result| {
+        const digest = result catch |err| {
+            printErrorMessage(current_command, .file_copy, .{entry.filenameAndExtension()}, err);
+            had_error = true;
+            continue;
+        };
+        try stdout.print("{x:0>16}\t{d}\t{d}\t{s}\n", .{ digest.hash, digest.size, entry.user, entry.filenameAndExtension() });
+    }
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
+/// Files being hashed by hashFiles()
+const ParallelHash = struct {
+    disk_image: *DiskImage,
+    entries: []const *const CookedDirEntry,
+    /// Result for each of `entries`.
+    digests: []FileHash.HashError!FileHash.Digest,
+    /// Index of the next entry to hash.
+    next_entry: std.atomic.Value(usize) = .init(0),
+
+    const Worker = struct {
+        hash: *ParallelHash,
+
+        fn run(self: *Worker) void {
+            const hash = self.hash;
+            while (true) {
+                const i = hash.next_entry.fetchAdd(1, .monotonic);
+                if (i >= hash.entries.len) return;
+                hash.digests[i] = FileHash.hashFile(hash.disk_image, hash.entries[i]);
+            }
+        }
+    };
+};
+
+/// Write every file on the image to stdout as a tar archive.
+/// CP/M and CDOS files are stored in a directory per user, e.g. 0/STAT.COM
+pub fn exportTar(_: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    const text_mode = getTextMode(options);
+    if (!disk_image.textModeSupported(text_mode)) {
+        printErrorMessage(current_command, .unsupported_text_mode, .{ disk_image.image_type.type_name, text_mode }, error.UnsupportedTextMode);
+        return error.CommandFailed;
+    }
+    const stdout = Console.stdout();
+    var tar: TarWriter = .init(stdout);
+    tar.writeGlobalHeader(&.{
+        .{ "ALTAIRDSK.image_type", disk_image.image_type.type_name },
+        .{ "ALTAIRDSK.text_mode", @tagName(text_mode) },
+    }) catch |err| {
+        printErrorMessage(current_command, .file_write, .{"stdout"}, err);
+        return error.CommandFailed;
+    };
+
+    var had_error = false;
+    for (disk_image.directory.cooked_directories.items) |*entry| {
+        if (options.cpm_user) |user| {
+            if (entry.user != user) continue;
+        }
+        var safe_buf: [std.fs.max_name_bytes]u8 = undefined;
+        const safe_filename = host_os.toSafeHostFilename(entry.filenameAndExtension(), &safe_buf) catch unreachable;
+        var path_buf: [std.fs.max_name_bytes + 4]u8 = undefined;
+        const path = switch (disk_image.image_type.OS) {
+            .cpm, .cdos => std.fmt.bufPrint(&path_buf, "{d}/{s}", .{ entry.user, safe_filename }) catch unreachable,
+            .ados, .hd_basic => safe_filename,
+        };
+
+        // The size is needed for the header before the contents. Outside the exact text mode,
+        // this copies the file twice, the first time just counting the bytes.
+        const size = disk_image.copiedSize(entry, text_mode) catch |err| {
+            printErrorMessage(current_command, .file_copy, .{entry.filenameAndExtension()}, err);
+            had_error = true;
+            continue;
+        };
+        const mtime = if (entry.modifiedDate()) |date| TarWriter.mtimeFromDate(date) else 0;
+
+        tar.writeFileHeader(path, size, mtime) catch |err| {
+            printErrorMessage(current_command, .file_write, .{"stdout"}, err);
+            return error.CommandFailed;
+        };
+        var contents_buffer: [256]u8 = undefined;
+        var contents = tar.fileWriter(size, &contents_buffer);
+        disk_image.copyFromImage(entry, &contents.interface, text_mode) catch |err| {
+            // The header has already been written, so the entry is finished with what was copied.
+            if (contents.too_long) log.warn("{s} is longer than its directory entry, truncated to {d} bytes", .{ entry.filenameAndExtension(), size });
+            printErrorMessage(current_command, .file_copy, .{entry.filenameAndExtension()}, err);
+            had_error = true;
+        };
+        if (contents.written < size) {
+            log.warn("{s} is shorter than its directory entry, padded from {d} to {d} bytes", .{ entry.filenameAndExtension(), contents.written, size });
+        }
+        tar.endFileWriter(&contents) catch |err| {
+            printErrorMessage(current_command, .file_write, .{"stdout"}, err);
+            return error.CommandFailed;
+        };
+    }
+    try tar.finish();
+
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
 /// Copy a file to the image
 pub fn putFile(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     try _putFile(ctx, disk_image, options.multiple_files[0], options);
 }
 
-/// Copy multiple files to the image
+/// Copy multiple files to the image.
+/// The host files are read ahead in parallel (see --jobs) while they are written to the image one after another,
+/// with the directory committed once at the end.
 pub fn putFileMultiple(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    const host_files = ctx.gpa.alloc(HostFile, options.multiple_files.len) catch OOM();
+    defer {
+        for (host_files) |*host_file| host_file.deinit(ctx.gpa);
+        ctx.gpa.free(host_files);
+    }
+    for (host_files, options.multiple_files) |*host_file, filename| host_file.* = .{ .filename = filename };
+
+    var read: ParallelRead = .init(ctx.io, ctx.gpa, host_files, disk_image.image_type.image_size, Workers.count(options.jobs, host_files.len));
+    read.start() catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+        return error.CommandFailed;
+    };
+    defer read.stop();
+
+    const began_transaction = disk_image.beginTransaction() catch OOM();
+    errdefer if (began_transaction) rollbackTransaction(disk_image);
+
     var had_error = false;
-    for (options.multiple_files) |filename| {
-        _putFile(ctx, disk_image, filename, options) catch |err| {
+    for (0..host_files.len) |i| {
+        const host_file = read.wait(i);
+        defer read.release(host_file);
+        const contents = host_file.contents catch |err| {
+            printErrorMessage(current_command, .file_open, .{host_file.filename}, err);
+            had_error = true;
+            continue;
+        };
+        var contents_reader: std.Io.Reader = .fixed(contents);
+        putFileContents(disk_image, &contents_reader, contents.len, host_file.filename, host_file.basename, options.cpm_user orelse 0, putTextMode(options), options) catch |err| {
             if (err == error.CommandFailedCanContinue) {
                 had_error = true;
                 continue;
@@ -509,24 +834,295 @@ pub fn putFileMultiple(ctx: Context, disk_image: *DiskImage, options: CommandLin
             }
         };
     }
+    if (began_transaction) try commitTransaction(disk_image, options.image_file);
     if (had_error) {
         return error.CommandFailed;
     }
 }
 
-pub fn _putFile(ctx: Context, disk_image: *DiskImage, filename: []const u8, options: CommandLineOptions) CommandError!void {
-    const cpm_user = options.cpm_user orelse 0;
+/// A host file read into memory by putFileMultiple()
+const HostFile = struct {
+    filename: []const u8,
+    /// The filename to use on the image.
+    basename: []const u8 = "",
+    basename_buf: [std.fs.max_name_bytes]u8 = undefined,
+    contents: ReadError![]u8 = error.NotRead,
+    /// Set once `contents` holds the result of reading the file.
+    ready: bool = false,
+
+    const ReadError = error{ NotRead, FileTooBig, EndOfStream, OutOfMemory } || std.Io.File.OpenError || std.Io.File.LengthError || std.Io.File.Reader.Error;
+
+    fn read(self: *HostFile, io: std.Io, gpa: std.mem.Allocator, max_size: usize) ReadError![]u8 {
+        self.basename = host_os.fromSafeHostFilename(std.fs.path.basename(self.filename), &self.basename_buf) catch unreachable;
+        const in_file = try std.Io.Dir.cwd().openFile(io, self.filename, .{ .mode = .read_only });
+        defer in_file.close(io);
+        const size = try in_file.length(io);
+        // No file larger than the image can fit.
+        if (size > max_size) return error.FileTooBig;
+
+        const contents = try gpa.alloc(u8, @intCast(size));
+        errdefer gpa.free(contents);
+        var file_reader = in_file.reader(io, &.{});
+        file_reader.interface.readSliceAll(contents) catch |err| switch (err) {
+            error.ReadFailed => return file_reader.err.?,
+            error.EndOfStream => return error.EndOfStream,
+        };
+        return contents;
+    }
+
+    fn deinit(self: *HostFile, gpa: std.mem.Allocator) void {
+        if (self.contents) |contents| gpa.free(contents) else |_| {}
+        self.contents = error.NotRead;
+    }
+};
+
+/// Host files read ahead by worker threads, in order, while the caller writes them to the image.
+/// Workers stay at most `read_ahead` files ahead of the last file released, so only a bounded
+/// number of files is held in memory however many are copied.
+const ParallelRead = struct {
+    io: std.Io,
+    gpa: std.mem.Allocator,
+    host_files: []HostFile,
+    max_size: usize,
+    read_ahead: usize,
+    threads: []std.Thread,
+    spawned: usize,
+    /// Protects everything below, and the `ready` flag and `contents` of each host file.
+    mutex: std.Io.Mutex,
+    /// Broadcast when a host file has been read.
+    file_read: std.Io.Condition,
+    /// Broadcast when a host file has been released, or the workers should stop.
+    released: std.Io.Condition,
+    /// Index of the next host file to read.
+    next_file: usize,
+    /// Number of host files released by the caller.
+    release_count: usize,
+    stopping: bool,
+
+    /// Files each worker may read ahead of the file being written.
+    const read_ahead_per_worker = 2;
+
+    fn init(io: std.Io, gpa: std.mem.Allocator, host_files: []HostFile, max_size: usize, worker_count: usize) ParallelRead {
+        return .{
+            .io = io,
+            .gpa = gpa,
+            .host_files = host_files,
+            .max_size = max_size,
+            .read_ahead = worker_count * read_ahead_per_worker,
+            .threads = &.{},
+            .spawned = 0,
+            .mutex = .init,
+            .file_read = .init,
+            .released = .init,
+            .next_file = 0,
+            .release_count = 0,
+            .stopping = false,
+        };
+    }
+
+    /// Start the workers, one thread each. The ParallelRead must not move until stop() returns.
+    fn start(self: *ParallelRead) (std.Thread.SpawnError || error{OutOfMemory})!void {
+        self.threads = try self.gpa.alloc(std.Thread, self.read_ahead / read_ahead_per_worker);
+        errdefer self.stop();
+        for (self.threads) |*thread| {
+            thread.* = try std.Thread.spawn(.{}, run, .{self});
+            self.spawned += 1;
+        }
+    }
+
+    /// Stop the workers once they finish the files they are reading. Files already read are left for HostFile.deinit().
+    fn stop(self: *ParallelRead) void {
+        self.mutex.lockUncancelable(self.io);
+        self.stopping = true;
+        self.released.broadcast(self.io);
+        self.mutex.unlock(self.io);
+        for (self.threads[0..self.spawned]) |thread| thread.join();
+        self.gpa.free(self.threads);
+        self.threads = &.{};
+        self.spawned = 0;
+    }
+
+    /// Wait until host file `index` has been read. Files must be waited for and released in order.
+    fn wait(self: *ParallelRead, index: usize) *HostFile {
+        const host_file = &self.host_files[index];
+        self.mutex.lockUncancelable(self.io);
+        defer self.mutex.unlock(self.io);
+        while (!host_file.ready) self.file_read.waitUncancelable(self.io, &self.mutex);
+        return host_file;
+    }
+
+    /// Free the contents of a host file returned by wait(), letting the workers read another file.
+    fn release(self: *ParallelRead, host_file: *HostFile) void {
+        host_file.deinit(self.gpa);
+        self.mutex.lockUncancelable(self.io);
+        defer self.mutex.unlock(self.io);
+        self.release_count += 1;
+        self.released.broadcast(self.io);
+    }
+
+    fn run(self: *ParallelRead) void {
+        const io = self.io;
+        self.mutex.lockUncancelable(io);
+        defer self.mutex.unlock(io);
+        while (true) {
+            while (!self.stopping and self.next_file < self.host_files.len and self.next_file >= self.release_count + self.read_ahead) {
+                self.released.waitUncancelable(io, &self.mutex);
+            }
+            if (self.stopping or self.next_file >= self.host_files.len) return;
+            const host_file = &self.host_files[self.next_file];
+            self.next_file += 1;
+
+            self.mutex.unlock(io);
+            const contents = host_file.read(io, self.gpa, self.max_size);
+            self.mutex.lockUncancelable(io);
+
+            host_file.contents = contents;
+            host_file.ready = true;
+            self.file_read.broadcast(io);
+        }
+    }
+};
+
+/// Make the files on the image match the regular files in a host directory.
+/// Host files are read in parallel (see --jobs) and only those whose size or contents differ from
+/// the file on the image are copied. With --delete, files missing from the host directory are erased.
+/// The directory is committed once at the end.
+pub fn syncDirectory(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    var arena_state: std.heap.ArenaAllocator = .init(ctx.gpa);
+    defer arena_state.deinit();
+    const arena = arena_state.allocator();
+
+    var filenames: std.ArrayList([]const u8) = .empty;
+    {
+        var host_dir = std.Io.Dir.cwd().openDir(ctx.io, options.sync_dir, .{ .iterate = true }) catch |err| {
+            printErrorMessage(current_command, .open_directory, .{options.sync_dir}, err);
+            return error.CommandFailed;
+        };
+        defer host_dir.close(ctx.io);
+        var itr = host_dir.iterateAssumeFirstIteration();
+        while (itr.next(ctx.io) catch |err| {
+            printErrorMessage(current_command, .open_directory, .{options.sync_dir}, err);
+            return error.CommandFailed;
+        }) |file| {
+            if (file.kind != .file) continue;
+            filenames.append(arena, std.fs.path.join(arena, &.{ options.sync_dir, file.name }) catch OOM()) catch OOM();
+        }
+    }
+    std.mem.sort([]const u8, filenames.items, {}, struct {
+        fn lessThan(_: void, lhs: []const u8, rhs: []const u8) bool {
+            return std.mem.lessThan(u8, lhs, rhs);
+        }
+    }.lessThan);
+
+    const host_files = ctx.gpa.alloc(HostFile, filenames.items.len) catch OOM();
+    defer {
+        for (host_files) |*host_file| host_file.deinit(ctx.gpa);
+        ctx.gpa.free(host_files);
+    }
+    for (host_files, filenames.items) |*host_file, filename| host_file.* = .{ .filename = filename };
+
+    var read: ParallelRead = .init(ctx.io, ctx.gpa, host_files, disk_image.image_type.image_size, Workers.count(options.jobs, host_files.len));
+    read.start() catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+        return error.CommandFailed;
+    };
+    defer read.stop();
+
+    const began_transaction = disk_image.beginTransaction() catch OOM();
+    errdefer if (began_transaction) rollbackTransaction(disk_image);
+
+    const user = options.cpm_user orelse 0;
+    const text_mode = putTextMode(options);
+    // Other text modes convert the contents, so the files on the image can't be compared with the host files.
+    const can_compare = text_mode == .Auto or text_mode == .Binary;
+    var put_options = options;
+    put_options.force = true;
+
+    // The image filename of every host file, to find the files to erase.
+    var synced: std.StringHashMapUnmanaged(void) = .empty;
+    var unchanged: usize = 0;
+    var copied: usize = 0;
+    var erased: usize = 0;
+    var had_error = false;
+    for (0..host_files.len) |i| {
+        const host_file = read.wait(i);
+        defer read.release(host_file);
+        const contents = host_file.contents catch |err| {
+            printErrorMessage(current_command, .file_open, .{host_file.filename}, err);
+            had_error = true;
+            continue;
+        };
+        var name_buf: [CookedDirEntry.filename_max]u8 = undefined;
+        if (DirectoryTable.translateToFilename(disk_image.image_type.OS, host_file.basename, &name_buf)) |image_filename| {
+            var key_buf: [CookedDirEntry.filename_max]u8 = undefined;
+            synced.put(arena, arena.dupe(u8, syncKey(&key_buf, image_filename)) catch OOM(), {}) catch OOM();
+            if (can_compare) {
+                if (disk_image.directory.findByFilename(image_filename, user)) |entry| {
+                    const same = sameContents(disk_image, entry, contents) catch |err| same: {
+                        log.info("Unable to compare {s}, copying it: {t}", .{ image_filename, err });
+                        break :same false;
+                    };
+                    if (same) {
+                        log.info("Unchanged {s}", .{image_filename});
+                        unchanged += 1;
+                        continue;
+                    }
+                }
+            }
+        } else |_| {} // Reported by putFileContents()
 
-    var text_mode: DiskImage.TextMode = .Auto;
-    if (options.text_mode) { // TODO: Change this to work as an enum option.. three options is just too much?
-        // We should also restrict to the OS it applies to... maybe twe add a "BASIC" enum instead of abusing Ascii?
-        text_mode = .Text;
-    } else if (options.bin_mode) {
-        text_mode = .Binary;
-    } else if (options.rand_mode) {
-        text_mode = .Rand;
+        var contents_reader: std.Io.Reader = .fixed(contents);
+        putFileContents(disk_image, &contents_reader, contents.len, host_file.filename, host_file.basename, user, text_mode, put_options) catch |err| {
+            if (err == error.CommandFailedCanContinue) {
+                had_error = true;
+                continue;
+            } else {
+                return err;
+            }
+        };
+        copied += 1;
     }
 
+    if (options.sync_delete) {
+        var to_erase: std.ArrayList(CookedDirEntry) = .empty;
+        for (disk_image.directory.cooked_directories.items) |entry| {
+            var key_buf: [CookedDirEntry.filename_max]u8 = undefined;
+            if (entry.user != user or synced.contains(syncKey(&key_buf, entry.filenameAndExtension()))) continue;
+            to_erase.append(arena, entry) catch OOM();
+        }
+        for (to_erase.items) |*entry| {
+            disk_image.erase(entry) catch |err| {
+                printErrorMessage(current_command, .file_erase, .{entry.filenameAndExtension()}, err);
+                had_error = true;
+                continue;
+            };
+            log.info("Erased file {s}", .{entry.filenameAndExtension()});
+            erased += 1;
+        }
+    }
+
+    if (began_transaction) try commitTransaction(disk_image, options.image_file);
+    try Console.stdout().print("{d} unchanged, {d} copied, {d} erased\n", .{ unchanged, copied, erased });
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
+/// Filenames match as they do for findByFilename(), ignoring case and a trailing '.'
+fn syncKey(buffer: []u8, filename: []const u8) []const u8 {
+    return std.ascii.upperString(buffer, std.mem.trimEnd(u8, filename, "."));
+}
+
+/// True if `entry` already holds `contents`, as putFileContents() would store them.
+/// Files of a different size are found without reading them.
+fn sameContents(disk_image: *DiskImage, entry: *const CookedDirEntry, contents: []const u8) FileHash.HashError!bool {
+    const expected = FileHash.hashContents(disk_image, contents);
+    if (entry.size_in_bytes != expected.size) return false;
+    const actual = try FileHash.hashFile(disk_image, entry);
+    return actual.hash == expected.hash and actual.size == expected.size;
+}
+
+pub fn _putFile(ctx: Context, disk_image: *DiskImage, filename: []const u8, options: CommandLineOptions) CommandError!void {
     var cwd = std.Io.Dir.cwd();
 
     var in_file = cwd.openFile(ctx.io, filename, .{ .mode = .read_only }) catch |err| {
@@ -540,7 +1136,23 @@ pub fn _putFile(ctx: Context, disk_image: *DiskImage, filename: []const u8, opti
     var conv_buf: [std.fs.max_name_bytes]u8 = undefined;
 
     const basename = host_os.fromSafeHostFilename(std.fs.path.basename(filename), &conv_buf) catch unreachable;
-    disk_image.copyToImage(&file_reader.interface, basename, cpm_user, options.force, text_mode) catch |err| {
+    const size = in_file.length(ctx.io) catch null;
+    try putFileContents(disk_image, &file_reader.interface, size, filename, basename, options.cpm_user orelse 0, putTextMode(options), options);
+}
+
+/// Text mode for copying files to the image.
+fn putTextMode(options: CommandLineOptions) DiskImage.TextMode {
+    // TODO: Change this to work as an enum option.. three options is just too much?
+    // We should also restrict to the OS it applies to... maybe twe add a "BASIC" enum instead of abusing Ascii?
+    if (options.text_mode) return .Text;
+    if (options.bin_mode) return .Binary;
+    if (options.rand_mode) return .Rand;
+    return .Auto;
+}
+
+/// Copy the contents of host file `filename` from `file_reader` to `basename` on the image.
+fn putFileContents(disk_image: *DiskImage, file_reader: *std.Io.Reader, size: ?u64, filename: []const u8, basename: []const u8, cpm_user: u8, text_mode: DiskImage.TextMode, options: CommandLineOptions) CommandError!void {
+    disk_image.copyToImageSized(file_reader, size, basename, cpm_user, options.force, text_mode) catch |err| {
         switch (err) {
             error.PathAlreadyExists => {
                 printErrorMessage(current_command, .file_exists, .{basename}, err);
@@ -567,6 +1179,235 @@ pub fn _putFile(ctx: Context, disk_image: *DiskImage, filename: []const u8, opti
     log.info("Copied file {s} to {s}", .{ filename, basename });
 }
 
+/// Copy every file in a tar archive read from stdin to the image, committing the directory once.
+/// Files in a directory named for a user number, e.g. 1/STAT.COM, are copied to that user.
+pub fn importTar(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    var file_name_buffer: [std.fs.max_path_bytes]u8 = undefined;
+    var link_name_buffer: [std.fs.max_path_bytes]u8 = undefined;
+    var iterator: std.tar.Iterator = .init(Console.stdin(), .{
+        .file_name_buffer = &file_name_buffer,
+        .link_name_buffer = &link_name_buffer,
+    });
+    // Each file is read into memory first, so its size is known when choosing its allocations.
+    var contents: std.Io.Writer.Allocating = .init(ctx.gpa);
+    defer contents.deinit();
+
+    const began_transaction = disk_image.beginTransaction() catch OOM();
+    errdefer if (began_transaction) rollbackTransaction(disk_image);
+
+    // A damaged archive stops the import, but the files before the damage are still committed.
+    var had_error = false;
+    while (true) {
+        const file = iterator.next() catch |err| {
+            printErrorMessage(current_command, .tar_read, .{}, err);
+            had_error = true;
+            break;
+        } orelse break;
+        if (file.kind != .file) {
+            if (file.kind != .directory) log.warn("Skipping {s}, only regular files can be imported", .{file.name});
+            continue;
+        }
+
+        contents.clearRetainingCapacity();
+        // No file larger than the image can fit.
+        const too_big = file.size > disk_image.image_type.image_size;
+        var discarding: std.Io.Writer.Discarding = .init(&.{});
+        iterator.streamRemaining(file, if (too_big) &discarding.writer else &contents.writer) catch |err| {
+            printErrorMessage(current_command, .tar_read, .{}, err);
+            had_error = true;
+            break;
+        };
+        if (too_big) {
+            printErrorMessage(current_command, .file_copy, .{file.name}, error.FileTooBig);
+            had_error = true;
+            continue;
+        }
+
+        var user = options.cpm_user orelse 0;
+        if (std.fs.path.dirname(file.name)) |dirname| {
+            if (std.fmt.parseInt(u8, std.fs.path.basename(dirname), 10)) |dir_user| {
+                if (dir_user <= DiskImageType.max_user) user = dir_user;
+            } else |_| {}
+        }
+        var conv_buf: [std.fs.max_name_bytes]u8 = undefined;
+        const basename = host_os.fromSafeHostFilename(std.fs.path.basename(file.name), &conv_buf) catch {
+            printErrorMessage(current_command, .file_copy, .{file.name}, error.NameTooLong);
+            had_error = true;
+            continue;
+        };
+        var contents_reader: std.Io.Reader = .fixed(contents.written());
+        putFileContents(disk_image, &contents_reader, file.size, file.name, basename, user, putTextMode(options), options) catch |err| {
+            if (err == error.CommandFailedCanContinue) {
+                had_error = true;
+                continue;
+            } else {
+                return err;
+            }
+        };
+    }
+    if (began_transaction) try commitTransaction(disk_image, options.image_file);
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
+/// Copy files straight from this image to another existing image, which can be of a different format.
+/// All files are copied unless filenames are given. Files keep their user if both images support users.
+pub fn transferFiles(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    var dest: SecondImage = undefined;
+    const dest_type = if (options.transfer_image_type) |type_id| all_disk_types.getPtrConst(type_id) else null;
+    dest.open(ctx.io, ctx.gpa, options.transfer_image, dest_type, true, options.quiet) catch |err| {
+        printErrorMessage(current_command, .open_image, .{options.transfer_image}, err);
+        return error.CommandFailed;
+    };
+    defer dest.close(ctx.io);
+    const dest_image = &dest.disk_image;
+
+    // Between the same OS, copy files exactly as they are stored, unless a text mode was requested.
+    const from_os = disk_image.image_type.OS;
+    const to_os = dest_image.image_type.OS;
+    const from_users = from_os == .cpm or from_os == .cdos;
+    const to_users = to_os == .cpm or to_os == .cdos;
+    const exact = (from_os == to_os or (from_users and to_users)) and
+        !(options.text_mode or options.bin_mode or options.rand_mode or options.basic_mode);
+    const from_mode = if (exact) disk_image.exactTextMode() else getTextMode(options);
+    const to_mode = if (exact) dest_image.exactTextMode() else putTextMode(options);
+
+    // Each file is copied into memory first, so its size is known when choosing its allocations.
+    var contents: std.Io.Writer.Allocating = .init(ctx.gpa);
+    defer contents.deinit();
+
+    const began_transaction = dest_image.beginTransaction() catch OOM();
+    errdefer if (began_transaction) rollbackTransaction(dest_image);
+
+    const all_files = [_][]const u8{"*"};
+    const patterns = if (options.multiple_files.len == 0) &all_files else options.multiple_files;
+    var had_error = false;
+    for (patterns) |file_pattern| {
+        var found_file = false;
+        var itr = disk_image.directory.findByFileNameWildcards(file_pattern, options.cpm_user);
+        while (itr.next()) |entry| {
+            found_file = true;
+            contents.clearRetainingCapacity();
+            disk_image.copyFromImage(entry, &contents.writer, from_mode) catch |err| {
+                printErrorMessage(current_command, .file_copy, .{entry.filenameAndExtension()}, err);
+                had_error = true;
+                continue;
+            };
+            const user = if (from_users) entry.user else options.cpm_user orelse 0;
+            // Altair DOS random access files are copied without their group map, which .Rand rebuilds.
+            const entry_to_mode: DiskImage.TextMode = if (exact and entry.fileType() == .random_access) .Rand else to_mode;
+            var contents_reader: std.Io.Reader = .fixed(contents.written());
+            const filename = entry.filenameAndExtension();
+            putFileContents(dest_image, &contents_reader, contents.written().len, filename, filename, user, entry_to_mode, options) catch |err| {
+                if (err == error.CommandFailedCanContinue) {
+                    had_error = true;
+                    continue;
+                } else {
+                    return err;
+                }
+            };
+        }
+        if (!found_file) {
+            had_error = true;
+            printErrorMessage(current_command, .no_matching_files, .{file_pattern}, error.None);
+        }
+    }
+    if (began_transaction) try commitTransaction(dest_image, options.transfer_image);
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
+/// List the files that differ between this image and a later copy of it.
+/// Only sectors that differ are attributed to files, so large images with few changes are compared quickly.
+pub fn diffImages(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    var new: SecondImage = undefined;
+    // Both images must be the same type, so don't detect a type that may be ambiguous.
+    new.open(ctx.io, ctx.gpa, options.diff_image, disk_image.image_type, false, options.quiet) catch |err| {
+        printErrorMessage(current_command, .open_image, .{options.diff_image}, err);
+        return error.CommandFailed;
+    };
+    defer new.close(ctx.io);
+
+    const start = std.Io.Clock.awake.now(ctx.io);
+    var diff = ImageDiff.compare(ctx.gpa, disk_image, &new.disk_image) catch |err| {
+        printErrorMessage(current_command, .image_compare, .{options.diff_image}, err);
+        return error.CommandFailed;
+    };
+    defer diff.deinit(ctx.gpa);
+    const end = std.Io.Clock.awake.now(ctx.io);
+    log.info("Compared images in {d:.3}ms", .{nsToMs(end.nanoseconds - start.nanoseconds)});
+
+    const stdout = Console.stdout();
+    for (diff.files.items) |file| {
+        const change: u8 = switch (file.change) {
+            .added => 'A',
+            .removed => 'D',
+            .modified => 'M',
+        };
+        try stdout.print("{c} {d: >2} {s: <12} {d: >5} sectors\n", .{ change, file.entry.user, file.entry.filenameAndExtension(), file.sectors });
+    }
+    if (diff.sectors > 0) {
+        try stdout.print("{d} sectors differ: {d} system, {d} directory, {d} free\n", .{
+            diff.sectors,
+            diff.system_sectors,
+            diff.directory_sectors,
+            diff.free_sectors,
+        });
+    }
+}
+
+/// An image opened in addition to the one being dispatched, e.g. the destination for transferFiles()
+/// The image type is auto-detected unless `image_type` is given.
+const SecondImage = struct {
+    file: std.Io.File,
+    file_reader: std.Io.File.Reader,
+    file_writer: std.Io.File.Writer,
+    disk_image: DiskImage,
+
+    fn open(self: *SecondImage, io: std.Io, gpa: std.mem.Allocator, filename: []const u8, requested_type: ?*const DiskImageType, write_access: bool, quiet: bool) !void {
+        self.file = try openDiskImage(io, filename, write_access, false);
+        errdefer self.file.close(io);
+        const image_type = if (requested_type) |image_type| image_type: {
+            if (!image_type.isCorrectFormat(io, self.file)) return error.InvalidImageFile;
+            break :image_type image_type;
+        } else image_type: {
+            var unique = false;
+            const image_type = DiskImage.detectImageType(io, self.file, &unique) orelse return error.CantDetectImage;
+            log.info("Image type of {s} detected as: {s}", .{ filename, image_type.type_name });
+            if (!unique and !quiet) {
+                Console.stderr().print(
+                    "WARNING: {s} and {s} formats cannot be distinguished with auto-detection. Assuming {s} for {s}. Use --to-type to set correct image type.\n",
+                    .{
+                        all_disk_type_names[@intFromEnum(DiskImageTypes.HDD_5MB)],
+                        all_disk_type_names[@intFromEnum(DiskImageTypes.HDD_5MB_1024)],
+                        image_type.type_name,
+                        filename,
+                    },
+                ) catch {};
+            }
+            break :image_type image_type;
+        };
+
+        self.file_reader = self.file.reader(io, &.{});
+        self.file_writer = self.file.writer(io, &.{});
+        self.disk_image = try DiskImage.init(gpa, .{ .on_disk = &self.file_reader }, .{ .on_disk = &self.file_writer }, image_type);
+        errdefer self.disk_image.deinit();
+        try self.disk_image.enableSectorCache(SectorCache.default_capacity);
+        try self.disk_image.loadDirectories(.full);
+    }
+
+    /// Write back any cached sectors and close the image.
+    fn close(self: *SecondImage, io: std.Io) void {
+        self.disk_image.flush() catch |err| {
+            printErrorMessage(current_command, .unexpected, .{}, err);
+        };
+        self.disk_image.deinit();
+        self.file.close(io);
+    }
+};
+
 /// Remove a file from the image
 pub fn eraseFile(_: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     const filename = std.fs.path.basename(options.multiple_files[0]);
@@ -838,6 +1679,197 @@ pub fn labelShow(_: Context, disk_image: *DiskImage, _: CommandLineOptions) Comm
     }
 }
 
+/// Commands that can be used in a batch script, and the command line option they correspond to.
+const batch_commands = [_]struct { []const u8, []const u8 }{
+    .{ "dir", "do_directory" },
+    .{ "raw", "do_raw_dir" },
+    .{ "get", "do_get" },
+    .{ "get-multiple", "do_get_multi" },
+    .{ "put", "do_put" },
+    .{ "put-multiple", "do_put_multi" },
+    .{ "erase", "do_erase" },
+    .{ "erase-multiple", "do_erase_multi" },
+    .{ "label", "do_label_get" },
+    .{ "label-set", "do_label_set" },
+};
+
+/// Largest batch script that will be read.
+const batch_script_max = 1024 * 1024;
+
+/// Run each command in a batch script against the already opened image.
+/// Each line is a command name, followed by any of the -t, -b, -n, -a, -f, -u and -o options and filenames.
+/// e.g. "put -u 1 FILE.TXT". Blank lines and lines starting with # are ignored.
+/// Directory writes are committed once, after the last command. -u, -j, --verify and how the image was opened
+/// apply to every line.
+pub fn runBatch(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    const script = readBatchScript(ctx, options.batch_file) catch |err| {
+        printErrorMessage(current_command, .file_open, .{options.batch_file}, err);
+        return error.CommandFailed;
+    };
+    defer ctx.gpa.free(script);
+
+    var filenames: std.ArrayList([]const u8) = .empty;
+    defer filenames.deinit(ctx.gpa);
+
+    const began_transaction = disk_image.beginTransaction() catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+        return error.CommandFailed;
+    };
+    errdefer if (began_transaction) rollbackTransaction(disk_image);
+
+    const batch_start = std.Io.Clock.awake.now(ctx.io);
+    var had_error = false;
+    var line_iter = std.mem.splitScalar(u8, script, '\n');
+    var line_nr: usize = 0;
+    while (line_iter.next()) |raw_line| {
+        line_nr += 1;
+        const line = std.mem.trim(u8, raw_line, " \t\r");
+        if (line.len == 0 or line[0] == '#') continue;
+
+        filenames.clearRetainingCapacity();
+        var line_options = batchLineOptions(ctx.gpa, options, line, &filenames) catch |err| {
+            printErrorMessage("batch", .batch_line, .{ line_nr, line }, err);
+            had_error = true;
+            continue;
+        };
+        line_options.multiple_files = filenames.items;
+
+        const start = std.Io.Clock.awake.now(ctx.io);
+        const result = runBatchCommand(ctx, disk_image, line_options);
+        const end = std.Io.Clock.awake.now(ctx.io);
+        current_command = "batch";
+        try Console.stderr().print("{d:>10.3}ms  {s}\n", .{ nsToMs(end.nanoseconds - start.nanoseconds), line });
+        result catch |err| switch (err) {
+            error.CommandFailed, error.CommandFailedCanContinue => had_error = true,
+            error.WriteFailed => return err,
+        };
+    }
+    if (began_transaction) try commitTransaction(disk_image, options.image_file);
+    const batch_end = std.Io.Clock.awake.now(ctx.io);
+    try Console.stderr().print("{d:>10.3}ms  Total\n", .{nsToMs(batch_end.nanoseconds - batch_start.nanoseconds)});
+
+    if (had_error) {
+        return error.CommandFailed;
+    }
+}
+
+/// Commit a transaction begun by a command. If the directory can't be written it no longer matches
+/// the file data already written, so the command fails.
+fn commitTransaction(disk_image: *DiskImage, image_file: []const u8) CommandError!void {
+    disk_image.commitTransaction() catch |err| {
+        printErrorMessage(current_command, .file_write, .{image_file}, err);
+        return error.CommandFailed;
+    };
+}
+
+/// Discard a transaction begun by a command that failed part way.
+fn rollbackTransaction(disk_image: *DiskImage) void {
+    disk_image.rollbackTransaction() catch |err| {
+        printErrorMessage(current_command, .unexpected, .{}, err);
+    };
+}
+
+/// Read the whole batch script from `filename`, or from stdin if `filename` is "-".
+/// Caller owns the returned memory.
+fn readBatchScript(ctx: Context, filename: []const u8) ![]u8 {
+    if (std.mem.eql(u8, filename, "-")) {
+        return Console.stdin().allocRemaining(ctx.gpa, .limited(batch_script_max));
+    }
+    const cwd = std.Io.Dir.cwd();
+    const script_file = try cwd.openFile(ctx.io, filename, .{ .mode = .read_only });
+    defer script_file.close(ctx.io);
+    var read_buffer: [4096]u8 = undefined;
+    var script_reader = script_file.reader(ctx.io, &read_buffer);
+    return script_reader.interface.allocRemaining(ctx.gpa, .limited(batch_script_max));
+}
+
+/// Build the options for a single batch script line.
+/// Filenames are appended to `filenames`, which the caller must set as the multiple_files option.
+fn batchLineOptions(gpa: std.mem.Allocator, options: CommandLineOptions, line: []const u8, filenames: *std.ArrayList([]const u8)) !CommandLineOptions {
+    var line_options: CommandLineOptions = .{
+        .image_file = options.image_file,
+        .disk_image_type = options.disk_image_type,
+        .cpm_user = options.cpm_user,
+        .quiet = options.quiet,
+        .verbose = options.verbose,
+        .very_verbose = options.very_verbose,
+        .jobs = options.jobs,
+        .verify = options.verify,
+        .in_memory = options.in_memory,
+        .no_mmap = options.no_mmap,
+    };
+    var tokens = std.mem.tokenizeAny(u8, line, " \t");
+    const command_name = std.mem.trimStart(u8, tokens.next().?, "-");
+    const option_name = option_name: {
+        for (batch_commands) |batch_command| {
+            if (std.mem.eql(u8, command_name, batch_command[0])) break :option_name batch_command[1];
+        }
+        return error.InvalidCommand;
+    };
+    inline for (batch_commands) |batch_command| {
+        if (std.mem.eql(u8, option_name, batch_command[1])) @field(line_options, batch_command[1]) = true;
+    }
+
+    while (tokens.next()) |token| {
+        if (token.len < 2 or token[0] != '-') {
+            try filenames.append(gpa, token);
+        } else if (std.mem.eql(u8, token, "-t") or std.mem.eql(u8, token, "--text")) {
+            line_options.text_mode = true;
+        } else if (std.mem.eql(u8, token, "-b") or std.mem.eql(u8, token, "--bin")) {
+            line_options.bin_mode = true;
+        } else if (std.mem.eql(u8, token, "-n") or std.mem.eql(u8, token, "--random")) {
+            line_options.rand_mode = true;
+        } else if (std.mem.eql(u8, token, "-a") or std.mem.eql(u8, token, "--basic")) {
+            line_options.basic_mode = true;
+        } else if (std.mem.eql(u8, token, "-f") or std.mem.eql(u8, token, "--force")) {
+            line_options.force = true;
+        } else if (std.mem.eql(u8, token, "-u") or std.mem.eql(u8, token, "--user")) {
+            const user = try std.fmt.parseInt(u8, tokens.next() orelse return error.MissingValue, 10);
+            if (user > DiskImageType.max_user) return error.InvalidUser;
+            line_options.cpm_user = user;
+        } else if (std.mem.eql(u8, token, "-o") or std.mem.eql(u8, token, "--out")) {
+            line_options.get_out_dir = tokens.next() orelse return error.MissingValue;
+        } else {
+            return error.InvalidOption;
+        }
+    }
+
+    if (line_options.do_label_set) {
+        if (filenames.items.len != 1) return error.InvalidLabelFormat;
+        line_options.disk_label = filenames.pop().?;
+    } else if (line_options.do_get or line_options.do_put or line_options.do_erase) {
+        if (filenames.items.len != 1) return error.InvalidFilename;
+    } else if (line_options.do_get_multi or line_options.do_put_multi or line_options.do_erase_multi) {
+        if (filenames.items.len == 0) return error.InvalidFilename;
+    } else if (filenames.items.len != 0) {
+        return error.InvalidFilename;
+    }
+    return line_options;
+}
+
+fn runBatchCommand(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    inline for (command_list) |command| {
+        if (comptime isBatchCommand(command.option)) {
+            if (@field(options, command.option)) {
+                current_command = command.name;
+                return command.action(ctx, disk_image, options);
+            }
+        }
+    }
+    unreachable;
+}
+
+fn isBatchCommand(comptime option: []const u8) bool {
+    for (batch_commands) |batch_command| {
+        if (std.mem.eql(u8, option, batch_command[1])) return true;
+    }
+    return false;
+}
+
+fn nsToMs(ns: i96) f64 {
+    return @as(f64, @floatFromInt(ns)) / std.time.ns_per_ms;
+}
+
 /// Try and recover an image with corrupted directory entries.
 pub fn recoverImage(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     log.info("Recovering {s} to {s}", .{ options.image_file, options.recovery_image_file });
@@ -888,6 +1920,36 @@ pub fn recoverImage(ctx: Context, disk_image: *DiskImage, options: CommandLineOp
 pub fn printImageInfo(_: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
     _ = options;
     disk_image.image_type.dump();
+
+    // The directory isn't loaded before this command, as the image may not be valid.
+    disk_image.loadDirectories(.full) catch |err| {
+        log.info("Not showing fragmentation, unable to load directory: {t}", .{err});
+        return;
+    };
+    const fragmentation = disk_image.directory.fragmentation();
+    const stderr = Console.stderr();
+    try stderr.print("Frag Files:   {} of {}\n", .{ fragmentation.fragmented_files, fragmentation.files });
+    try stderr.print("Free Runs:    {}\n", .{fragmentation.free_runs});
+    try stderr.print("Largest Run:  {}\n", .{fragmentation.largest_free_run});
+}
+
+/// Move every file into consecutive allocations and pack the files together at the start of the image.
+pub fn defragmentImage(ctx: Context, disk_image: *DiskImage, options: CommandLineOptions) CommandError!void {
+    const before = disk_image.directory.fragmentation();
+    const start = std.Io.Clock.awake.now(ctx.io);
+    const stats = Defragment.defragment(ctx.gpa, disk_image) catch |err| {
+        printErrorMessage(current_command, .defragment, .{options.image_file}, err);
+        return error.CommandFailed;
+    };
+    const end = std.Io.Clock.awake.now(ctx.io);
+    log.info("Defragmented image in {d:.3}ms", .{nsToMs(end.nanoseconds - start.nanoseconds)});
+
+    const after = disk_image.directory.fragmentation();
+    const stdout = Console.stdout();
+    try stdout.print("Moved {} allocations of {} files\n", .{ stats.moved_allocations, stats.files });
+    try stdout.print("Frag Files:   {} -> {}\n", .{ before.fragmented_files, after.fragmented_files });
+    try stdout.print("Free Runs:    {} -> {}\n", .{ before.free_runs, after.free_runs });
+    try stdout.print("Largest Run:  {} -> {}\n", .{ before.largest_free_run, after.largest_free_run });
 }
 
 fn openDiskImage(io: std.Io, filename: []const u8, writeable: bool, create_file: bool) !std.Io.File {
@@ -902,6 +1964,8 @@ fn openDiskImage(io: std.Io, filename: []const u8, writeable: bool, create_file:
 }
 
 fn printErrorMessage(command: []const u8, comptime message: ErrorMessage, args: anytype, err: anyerror) void {
+    Console.lock();
+    defer Console.unlock();
     Console.stderr().print("Error performing {s}: ", .{command}) catch {};
     Console.stderr().print(error_messages.get(message), args) catch {};
 
@@ -940,6 +2004,12 @@ fn printErrorMessage(command: []const u8, comptime message: ErrorMessage, args:
         error.PathAlreadyExists => {
             Console.stderr().print(": File already exists\n", .{}) catch {};
         },
+        error.DifferentImageTypes => {
+            Console.stderr().print(": The images are different types\n", .{}) catch {};
+        },
+        error.DefragmentNotSupported => {
+            Console.stderr().print(": Not supported for this image type\n", .{}) catch {};
+        },
         else => {
             Console.stderr().print(": {s}\n", .{@errorName(err)}) catch {};
         },
@@ -978,6 +2048,11 @@ const ErrorMessage = enum {
     directory_list,
     read_only_support,
     unsupported_text_mode,
+    batch_line,
+    tar_read,
+    image_compare,
+    defragment,
+    open_socket,
 };
 
 const error_messages = std.EnumArray(ErrorMessage, []const u8).init(
@@ -1009,12 +2084,22 @@ const error_messages = std.EnumArray(ErrorMessage, []const u8).init(
         .directory_list = "Error listing directory",
         .read_only_support = "Writing is not supported for format {t}",
         .unsupported_text_mode = "Format {s} does not support text mode {t}",
+        .batch_line = "Invalid batch command on line {d}: {s}",
+        .tar_read = "Error reading tar archive from stdin",
+        .image_compare = "Error comparing with {s}",
+        .defragment = "Error defragmenting {s}",
+        .open_socket = "Error listening on socket {s}",
     },
 );
 
 const std = @import("std");
 const di = @import("disk_image.zig");
 const DiskImage = di.DiskImage;
+const MappedImage = di.MappedImage;
+const LoadedImage = di.LoadedImage;
+const SeekableReader = di.SeekableReader;
+const SeekableWriter = di.SeekableWriter;
+const SectorCache = @import("sector_cache.zig");
 const DirectoryTable = @import("directory_table.zig").DirectoryTable;
 const DiskImageType = @import("disk_types.zig").DiskImageType;
 const DiskImageTypes = @import("disk_types.zig").DiskImageTypes;
@@ -1025,3 +2110,10 @@ const CommandLineOptions = @import("main.zig").CommandLineOptions;
 const Console = @import("console.zig");
 const hd_basic = @import("os_hd_basic.zig");
 const host_os = @import("host_os.zig");
+const Inventory = @import("inventory.zig");
+const Workers = @import("workers.zig");
+const TarWriter = @import("tar.zig");
+const ImageDiff = @import("image_diff.zig");
+const FileHash = @import("file_hash.zig");
+const Defragment = @import("defragment.zig");
+const ImageServer = @import("image_server.zig");
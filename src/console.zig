@@ -1,5 +1,6 @@
 //! Provide a global, buffered stdin and stdout
 //! and non-buffered stderr.
+//! Threads should hold lock() while writing a message.
 
 var internal: struct {
     stdin: std.Io.File.Reader,
@@ -8,9 +9,14 @@ var internal: struct {
 
     stdin_buffer: [4096]u8,
     stdout_buffer: [4096]u8,
+
+    io: std.Io,
+    mutex: std.Io.Mutex,
 } = undefined;
 
 pub fn init(io: std.Io) void {
+    internal.io = io;
+    internal.mutex = .init;
     internal.stdin = .initStreaming(.stdin(), io, &internal.stdin_buffer);
     internal.stdout = .initStreaming(.stdout(), io, &internal.stdout_buffer);
     internal.stderr = .initStreaming(.stderr(), io, &.{});
@@ -28,6 +34,15 @@ pub fn stderr() *std.Io.Writer {
     return &internal.stderr.interface;
 }
 
+/// Stop other threads writing to stdout or stderr until unlock().
+pub fn lock() void {
+    internal.mutex.lockUncancelable(internal.io);
+}
+
+pub fn unlock() void {
+    internal.mutex.unlock(internal.io);
+}
+
 /// Flushes output
 pub fn deinit() void {
     flushOut() catch {};
@@ -0,0 +1,270 @@
+//! Rewrite the files on an image so each one is stored in consecutive allocations, in the order
+//! the files currently start on the image, packed together from the start of the data area.
+//! Allocations are moved in place by following each chain of moves, so at most two allocations
+//! of data are held in memory, then every directory entry is rewritten in a single transaction.
+//! Not supported for Altair DOS, where every sector links to the next and random access files
+//! have their own group maps.
+
+pub const Stats = struct {
+    /// Number of files that were packed together.
+    files: usize = 0,
+    /// Number of allocations whose data was moved.
+    moved_allocations: usize = 0,
+};
+
+pub const DefragmentError = error{ DefragmentNotSupported, InvalidAllocation, OutOfMemory } || DiskImage.CommitError;
+
+/// Defragment `image`, which must have its directory fully loaded.
+/// Any pointers to the allocations of CookedDirEntries remain valid, but their contents change.
+/// Note: The data is moved before the directory is written, so an interrupted defragment leaves the image corrupt.
+pub fn defragment(gpa: std.mem.Allocator, image: *DiskImage) DefragmentError!Stats {
+    switch (image.image_type.OS) {
+        .cpm, .cdos => {},
+        .hd_basic => if (image.image_type.type_id == .TIMESHARE_BASIC) return error.ReadOnlySupport,
+        .ados => return error.DefragmentNotSupported,
+    }
+
+    var layout: Layout = try .plan(gpa, image);
+    defer layout.deinit(gpa);
+
+    const began_transaction = try image.beginTransaction();
+    errdefer if (began_transaction) image.rollbackTransaction() catch {};
+
+    const moved_allocations = try moveAllocations(gpa, image, &layout);
+    if (image.image_type.OS == .hd_basic) try remapIndirectGroups(image, &layout);
+    try remapDirectory(image, &layout);
+
+    if (began_transaction) try image.commitTransaction();
+    return .{ .files = layout.files, .moved_allocations = moved_allocations };
+}
+
+/// Where every allocation owned by a file is moved to.
+const Layout = struct {
+    /// New allocation for every allocation on the image. Allocations that don't move map to themselves.
+    new_location: []u16,
+    /// Allocations owned by a file that is being moved.
+    owned: std.DynamicBitSetUnmanaged,
+    files: usize,
+
+    fn plan(gpa: std.mem.Allocator, image: *DiskImage) (error{ InvalidAllocation, OutOfMemory } || DiskImage.ReadSectorError)!Layout {
+        const image_type = image.image_type;
+        const directory = &image.directory;
+
+        const new_location = try gpa.alloc(u16, image_type.total_allocs);
+        errdefer gpa.free(new_location);
+        for (new_location, 0..) |*location, allocation| location.* = @intCast(allocation);
+        var owned: std.DynamicBitSetUnmanaged = try .initEmpty(gpa, image_type.total_allocs);
+        errdefer owned.deinit(gpa);
+
+        // Every allocation of every file, in file order, and where each file's allocations start.
+        var chains: std.ArrayList(u16) = .empty;
+        defer chains.deinit(gpa);
+        var files: std.ArrayList(Chain) = .empty;
+        defer files.deinit(gpa);
+
+        for (directory.cooked_directories.items) |*entry| {
+            const start = chains.items.len;
+            try appendChain(gpa, image, entry, &chains);
+            const chain = chains.items[start..];
+            if (chain.len == 0) continue;
+
+            // Files in the directory area, e.g. a damaged entry, are left where they are.
+            const movable = for (chain) |allocation| {
+                if (allocation < image_type.reserved_allocs) break false;
+            } else true;
+            if (!movable) {
+                chains.shrinkRetainingCapacity(start);
+                continue;
+            }
+            for (chain) |allocation| {
+                if (allocation >= image_type.total_allocs or owned.isSet(allocation)) {
+                    log.err("Can't defragment {s}. Allocation {} is invalid or used by another file.", .{ entry.filenameAndExtension(), allocation });
+                    return error.InvalidAllocation;
+                }
+                owned.set(allocation);
+            }
+            try files.append(gpa, .{ .start = start, .len = chain.len });
+        }
+
+        // Keep the files in the order they are already on the image, so files near the start move least.
+        std.mem.sort(Chain, files.items, @as([]const u16, chains.items), Chain.lessThan);
+
+        // Every free or owned allocation can be used, the rest belong to the directory or to files left in place.
+        var slot: usize = 0;
+        for (files.items) |file| {
+            for (chains.items[file.start..][0..file.len]) |allocation| {
+                while (!directory.free_allocations.isSet(slot) and !owned.isSet(slot)) slot += 1;
+                new_location[allocation] = @intCast(slot);
+                slot += 1;
+            }
+        }
+        return .{ .new_location = new_location, .owned = owned, .files = files.items.len };
+    }
+
+    fn deinit(self: *Layout, gpa: std.mem.Allocator) void {
+        self.owned.deinit(gpa);
+        gpa.free(self.new_location);
+    }
+
+    fn remap(self: *const Layout, allocation: u16) u16 {
+        return if (allocation < self.new_location.len) self.new_location[allocation] else allocation;
+    }
+
+    const Chain = struct {
+        start: usize,
+        len: usize,
+
+        fn lessThan(chains: []const u16, lhs: Chain, rhs: Chain) bool {
+            return chains[lhs.start] < chains[rhs.start];
+        }
+    };
+};
+
+/// Append the allocations of `entry` in file order.
+/// For large HD BASIC files, the groups holding the lists of data groups come first.
+fn appendChain(gpa: std.mem.Allocator, image: *DiskImage, entry: *const CookedDirEntry, chains: *std.ArrayList(u16)) (error{OutOfMemory} || DiskImage.ReadSectorError)!void {
+    try chains.appendSlice(gpa, entry.allocations.items);
+    if (entry.os == .hd_basic and entry.fileType() == .large) {
+        var buffer: [256]u8 = undefined;
+        var file_reader: os_hd_basic.ImageFileReader = .init(image, entry, &buffer);
+        while (try file_reader.nextAllocation()) |allocation| {
+            try chains.append(gpa, allocation);
+        }
+    }
+}
+
+/// Move the data of every allocation to its new location. Returns the number of allocations moved.
+fn moveAllocations(gpa: std.mem.Allocator, image: *DiskImage, layout: *const Layout) (error{OutOfMemory} || DiskImage.ReadSectorError || DiskImage.WriteSectorError)!usize {
+    const sectors_per_alloc = image.image_type.sectors_per_alloc;
+    const buffers = try gpa.alloc(DiskSector, 2 * sectors_per_alloc);
+    defer gpa.free(buffers);
+    const span_buffer = try gpa.alloc(u8, @as(usize, sectors_per_alloc) * DiskSector.sector_size_max);
+    defer gpa.free(span_buffer);
+    var moved: std.DynamicBitSetUnmanaged = try .initEmpty(gpa, layout.new_location.len);
+    defer moved.deinit(gpa);
+
+    var carried = buffers[0..sectors_per_alloc];
+    var next = buffers[sectors_per_alloc..];
+    var moved_count: usize = 0;
+    var itr = layout.owned.iterator(.{});
+    while (itr.next()) |start| {
+        if (moved.isSet(start) or layout.new_location[start] == start) continue;
+
+        // Pick up the data at the start of the chain, then keep moving it along until it
+        // lands on a free allocation, or one whose data has already been moved away.
+        try readAllocation(image, @intCast(start), carried, span_buffer);
+        var from: u16 = @intCast(start);
+        while (true) {
+            moved.set(from);
+            moved_count += 1;
+            const to = layout.new_location[from];
+            const carry_on = layout.owned.isSet(to) and !moved.isSet(to);
+            if (carry_on) try readAllocation(image, to, next, span_buffer);
+            try writeAllocation(image, to, carried);
+            if (!carry_on) break;
+            std.mem.swap([]DiskSector, &carried, &next);
+            from = to;
+        }
+    }
+    return moved_count;
+}
+
+fn readAllocation(image: *DiskImage, allocation: u16, sectors: []DiskSector, span_buffer: []u8) DiskImage.ReadSectorError!void {
+    var locations: [DiskImage.max_batch_sectors]PhysicalAddress = undefined;
+    for (locations[0..sectors.len], 0..) |*location, record| location.* = allocationSector(image.image_type, allocation, record);
+    try image.readSectorBatch(locations[0..sectors.len], sectors, span_buffer);
+}
+
+fn writeAllocation(image: *DiskImage, allocation: u16, sectors: []DiskSector) DiskImage.WriteSectorError!void {
+    for (sectors, 0..) |*data, record| {
+        const location = allocationSector(image.image_type, allocation, record);
+        // Hard sectored formats hold the track and sector in each sector, so only the data is copied.
+        var sector: DiskSector = .initFormatted(image.image_type, location);
+        @memcpy(sector.dataBytes(), data.dataBytes());
+        try image.writeSector(location, &sector);
+    }
+}
+
+/// HD BASIC numbers allocations from the start of the disk, the others from the first data track.
+fn allocationSector(image_type: *const DiskImageType, allocation: u16, record: usize) PhysicalAddress {
+    const first_track = if (image_type.OS == .hd_basic) 0 else image_type.reserved_tracks;
+    const sector = @as(usize, allocation) * image_type.sectors_per_alloc + record;
+    return .{
+        .track = @intCast(first_track + sector / image_type.sectors_per_track),
+        .sector = @intCast(sector % image_type.sectors_per_track),
+    };
+}
+
+/// Update the lists of data groups of large HD BASIC files, which have already been moved to their new location.
+fn remapIndirectGroups(image: *DiskImage, layout: *const Layout) (DiskImage.ReadSectorError || DiskImage.WriteSectorError)!void {
+    for (image.directory.cooked_directories.items) |*entry| {
+        if (entry.fileType() != .large) continue;
+        for (entry.allocations.items) |indirect_group| {
+            for (0..image.image_type.sectors_per_alloc) |record| {
+                const location = allocationSector(image.image_type, layout.remap(indirect_group), record);
+                var sector: DiskSector = .initUnformatted(image.image_type, location.track);
+                try image.readSector(location, &sector);
+                const groups: []align(1) u16 = @ptrCast(sector.dataBytes());
+                for (groups) |*group| {
+                    if (group.* != 0xffff) group.* = layout.remap(group.*);
+                }
+                try image.writeSector(location, &sector);
+            }
+        }
+    }
+}
+
+/// Point the raw and cooked directory entries and the free allocations at the new locations.
+fn remapDirectory(image: *DiskImage, layout: *const Layout) (DiskImage.ReadSectorError || DiskImage.WriteSectorError || error{ReadOnlySupport} || RawDirError)!void {
+    const image_type = image.image_type;
+    const directory = &image.directory;
+
+    switch (directory.raw_directories) {
+        .cpm => |raw_entries| for (raw_entries.items, 0..) |*raw_entry, entry_nr| {
+            // Disk labels count as deleted, and have no allocations.
+            if (raw_entry.isDeleted()) continue;
+            for (0..raw_entry.allocationsCount(image_type)) |i| {
+                const allocation = try raw_entry.allocationGet(i, image_type);
+                try raw_entry.allocationSet(i, layout.remap(allocation), image_type);
+            }
+            try image.rawEntryWrite(@intCast(entry_nr));
+        },
+        .hd_basic => |raw_entries| for (raw_entries.items, 0..) |*raw_entry, entry_nr| {
+            if (raw_entry.isDeleted()) continue;
+            for (&raw_entry.allocations) |*allocation| {
+                if (allocation.* == 0xffff) break;
+                allocation.* = layout.remap(allocation.*);
+            }
+            raw_entry.last_group = layout.remap(raw_entry.last_group);
+            try image.rawEntryWrite(@intCast(entry_nr));
+        },
+        .ados => unreachable,
+    }
+
+    for (directory.cooked_directories.items) |*entry| {
+        for (entry.allocations.items) |*allocation| allocation.* = layout.remap(allocation.*);
+        switch (entry.os) {
+            .hd_basic => |*hd_basic| hd_basic.last_group = layout.remap(hd_basic.last_group),
+            else => {},
+        }
+    }
+
+    // Allocations a file moved out of are free, unless another file moved into them.
+    var itr = layout.owned.iterator(.{});
+    while (itr.next()) |allocation| directory.allocationFreed(@intCast(allocation));
+    itr = layout.owned.iterator(.{});
+    while (itr.next()) |allocation| directory.free_allocations.unset(layout.new_location[allocation]);
+    if (image_type.OS == .hd_basic) try os_hd_basic.writeAllocationBitmap(image);
+}
+
+const std = @import("std");
+const log = std.log.scoped(.altair_disk_lib);
+const DiskImage = @import("disk_image.zig").DiskImage;
+const disk_types = @import("disk_types.zig");
+const DiskImageType = disk_types.DiskImageType;
+const DiskSector = disk_types.DiskSector;
+const PhysicalAddress = disk_types.PhysicalAddress;
+const directory_table = @import("directory_table.zig");
+const CookedDirEntry = directory_table.CookedDirEntry;
+const RawDirError = directory_table.DirectoryTable.RawDirError;
+const os_hd_basic = @import("os_hd_basic.zig");
@@ -132,24 +132,49 @@ pub const DirectoryTable = struct {
     /// and will change the sorting order.
     cooked_directories: std.ArrayListUnmanaged(CookedDirEntry),
 
+    /// Index into cooked_directories by case-folded filename, both for the entry's user and any user.
+    /// Kept in sync by appendCookedEntry() and reindexCookedEntries(). See findByFilename()
+    filename_index: std.AutoHashMapUnmanaged(FilenameKey, u16),
+
     /// A record of the disk allocations _not_ used by any file.
     free_allocations: std.DynamicBitSetUnmanaged,
+    /// No allocation before this one is free. See allocationFindFree()
+    free_allocation_cursor: u16,
+    /// No raw directory entry before this one is free. See rawEntryFreed()
+    free_entry_cursor: u16,
     image_type: *const DiskImageType,
 
     pub fn init(gpa: std.mem.Allocator, image_type: *const DiskImageType) std.mem.Allocator.Error!DirectoryTable {
-        var arena = std.heap.ArenaAllocator.init(gpa);
-        errdefer arena.deinit();
-        return .{
-            .raw_directories = switch (image_type.OS) {
-                .cpm, .cdos => .{ .cpm = try .initCapacity(arena.allocator(), image_type.directories) },
-                .ados => .{ .ados = try .initCapacity(arena.allocator(), image_type.directories) },
-                .hd_basic => .{ .hd_basic = try .initCapacity(arena.allocator(), image_type.directories) },
-            },
-            .cooked_directories = try .initCapacity(arena.allocator(), image_type.directories),
-            .free_allocations = try .initFull(arena.allocator(), image_type.total_allocs),
-            .arena = arena,
-            .image_type = image_type,
+        var table: DirectoryTable = undefined;
+        table.arena = .init(gpa);
+        errdefer table.arena.deinit();
+        try table.initTables(image_type);
+        return table;
+    }
+
+    /// Empty the table so it can be loaded from another image, possibly of a different type.
+    /// The memory already allocated by the arena is kept for reuse.
+    pub fn reset(self: *DirectoryTable, image_type: *const DiskImageType) std.mem.Allocator.Error!void {
+        _ = self.arena.reset(.retain_capacity);
+        try self.initTables(image_type);
+    }
+
+    fn initTables(self: *DirectoryTable, image_type: *const DiskImageType) std.mem.Allocator.Error!void {
+        const arena = self.arena.allocator();
+        var filename_index: std.AutoHashMapUnmanaged(FilenameKey, u16) = .empty;
+        // Each cooked entry is indexed for both its user and any user.
+        try filename_index.ensureTotalCapacity(arena, @as(u32, image_type.directories) * 2);
+        self.raw_directories = switch (image_type.OS) {
+            .cpm, .cdos => .{ .cpm = try .initCapacity(arena, image_type.directories) },
+            .ados => .{ .ados = try .initCapacity(arena, image_type.directories) },
+            .hd_basic => .{ .hd_basic = try .initCapacity(arena, image_type.directories) },
         };
+        self.cooked_directories = try .initCapacity(arena, image_type.directories);
+        self.filename_index = filename_index;
+        self.free_allocations = try .initFull(arena, image_type.total_allocs);
+        self.free_allocation_cursor = 0;
+        self.free_entry_cursor = 0;
+        self.image_type = image_type;
     }
 
     pub fn deinit(self: *DirectoryTable) void {
@@ -192,7 +217,10 @@ pub const DirectoryTable = struct {
         }
         cooked_dir.allocations.clearAndFree(self.allocator());
         // Make sure to always remove the deleted CookedDir.
-        defer _ = self.cooked_directories.orderedRemove(cooked_index);
+        defer {
+            _ = self.cooked_directories.orderedRemove(cooked_index);
+            self.reindexCookedEntries();
+        }
 
         // Delete all the raw_entries and write to disk.
         switch (self.raw_directories) {
@@ -201,6 +229,7 @@ pub const DirectoryTable = struct {
                 for (raw_dirs.items, 0..) |*raw_item, idx| {
                     if (!raw_item.isDeleted() and raw_item.eql(cooked_dir)) {
                         raw_item.setDeleted();
+                        self.rawEntryFreed(@intCast(idx));
                         try disk_image.rawEntryWrite(@intCast(idx));
                         // For altair dos, also need to go through and set all of the file numbers in each
                         // sector, the bytes_written, next_track and next_sector to 0
@@ -223,8 +252,109 @@ pub const DirectoryTable = struct {
     fn allocationSetFree(self: *DirectoryTable, image: *DiskImage, to_erase: *const CookedDirEntry, alloc: u16) void {
         switch (self.image_type.OS) {
             .hd_basic => os_hd_basic.allocationSetFree(image, to_erase, alloc),
-            else => self.free_allocations.set(alloc),
+            else => self.allocationFreed(alloc),
+        }
+    }
+
+    /// Mark an allocation as free.
+    /// The caller is responsible for checking the allocation is valid.
+    pub fn allocationFreed(self: *DirectoryTable, alloc: u16) void {
+        self.free_allocations.set(alloc);
+        self.free_allocation_cursor = @min(self.free_allocation_cursor, alloc);
+    }
+
+    /// Return the first free allocation at or after `start`, or null if there are none.
+    /// Searches a word of the bitset at a time.
+    pub fn allocationFindFree(self: *const DirectoryTable, start: usize) ?u16 {
+        const MaskInt = std.DynamicBitSetUnmanaged.MaskInt;
+        const mask_bits = @bitSizeOf(MaskInt);
+        const bit_length = self.free_allocations.bit_length;
+        if (start >= bit_length) return null;
+
+        const num_masks = (bit_length + mask_bits - 1) / mask_bits;
+        var mask_index = start / mask_bits;
+        var mask = self.free_allocations.masks[mask_index] & (~@as(MaskInt, 0) << @intCast(start % mask_bits));
+        while (mask == 0) {
+            mask_index += 1;
+            if (mask_index == num_masks) return null;
+            mask = self.free_allocations.masks[mask_index];
         }
+        const alloc = mask_index * mask_bits + @ctz(mask);
+        return if (alloc < bit_length) @intCast(alloc) else null;
+    }
+
+    /// Take the first free allocation, starting the search from the cursor rather than allocation 0.
+    pub fn allocationTakeFirstFree(self: *DirectoryTable) ?u16 {
+        const alloc = self.allocationFindFree(self.free_allocation_cursor) orelse return null;
+        self.free_allocations.unset(alloc);
+        self.free_allocation_cursor = alloc + 1;
+        return alloc;
+    }
+
+    /// Return the start of the smallest run of at least `len` contiguous free allocations,
+    /// or null if there is no run that large.
+    pub fn allocationFindRun(self: *const DirectoryTable, len: usize) ?u16 {
+        var best_start: ?usize = null;
+        var best_len: usize = std.math.maxInt(usize);
+        var search_from: usize = self.free_allocation_cursor;
+        while (self.allocationFindFree(search_from)) |run_start| {
+            const run_end = self.freeRunEnd(run_start);
+            const run_len = run_end - run_start;
+            if (run_len >= len and run_len < best_len) {
+                best_start = run_start;
+                best_len = run_len;
+                if (run_len == len) break;
+            }
+            search_from = run_end;
+        }
+        return if (best_start) |start| @intCast(start) else null;
+    }
+
+    /// Return the allocation after the end of the run of free allocations starting at `run_start`
+    fn freeRunEnd(self: *const DirectoryTable, run_start: usize) usize {
+        var run_end = run_start;
+        while (run_end < self.free_allocations.bit_length and self.free_allocations.isSet(run_end)) {
+            run_end += 1;
+        }
+        return run_end;
+    }
+
+    pub const Fragmentation = struct {
+        files: usize,
+        /// Files that are not stored in a single run of contiguous allocations.
+        fragmented_files: usize,
+        /// Number of separate runs of free allocations.
+        free_runs: usize,
+        largest_free_run: usize,
+    };
+
+    /// Measure how fragmented the files and the free space are.
+    pub fn fragmentation(self: *const DirectoryTable) Fragmentation {
+        var result: Fragmentation = .{ .files = self.cooked_directories.items.len, .fragmented_files = 0, .free_runs = 0, .largest_free_run = 0 };
+        for (self.cooked_directories.items) |entry| {
+            const allocations = entry.allocations.items;
+            for (1..allocations.len) |i| {
+                // Unused allocations are zero.
+                if (allocations[i] == 0) break;
+                if (allocations[i] != allocations[i - 1] + 1) {
+                    result.fragmented_files += 1;
+                    break;
+                }
+            }
+        }
+        var search_from: usize = 0;
+        while (self.allocationFindFree(search_from)) |run_start| {
+            const run_end = self.freeRunEnd(run_start);
+            result.free_runs += 1;
+            result.largest_free_run = @max(result.largest_free_run, run_end - run_start);
+            search_from = run_end;
+        }
+        return result;
+    }
+
+    /// Must be called whenever a raw directory entry is deleted, so it can be found again by rawEntryGetFree()
+    pub fn rawEntryFreed(self: *DirectoryTable, entry_nr: u16) void {
+        self.free_entry_cursor = @min(self.free_entry_cursor, entry_nr);
     }
 
     /// Translate from host filename to image-compatible filename.
@@ -243,22 +373,71 @@ pub const DirectoryTable = struct {
     }
 
     /// Find by exact match. Case insentitive.
+    /// If there are duplicate entries, returns the first in directory order.
     /// FUTURE TODO: not all formats are case insensitive.
     pub fn findByFilename(self: *const DirectoryTable, filename: []const u8, user: ?u8) ?*CookedDirEntry {
-        // Can't use a binary search here as when adding new files, they are added at the end,
-        // not in alhpabetical order. So need to walk entire directory. There are 1024 entries
-        // at most.
-        for (self.cooked_directories.items) |*entry| {
-            if (user) |u| {
-                if (entry.user != u) continue;
-            }
-            if (FileNameIterator.filenameEqual(filename, entry.filenameAndExtension(), false)) {
-                return entry;
+        const key_user = if (user) |u| u else FilenameKey.any_user;
+        var found = self.findIndex(filename, key_user);
+        // Treat ABC. and ABC as equal.
+        if (filename.len > 0 and filename[filename.len - 1] == '.') {
+            if (self.findIndex(filename[0 .. filename.len - 1], key_user)) |without_dot| {
+                found = @min(found orelse without_dot, without_dot);
             }
         }
-        return null;
+        return if (found) |index| &self.cooked_directories.items[index] else null;
+    }
+
+    fn findIndex(self: *const DirectoryTable, filename: []const u8, user: u16) ?u16 {
+        const key = FilenameKey.init(filename, user) orelse return null;
+        return self.filename_index.get(key);
     }
 
+    /// Add a new file to the end of the cooked directory.
+    pub fn appendCookedEntry(self: *DirectoryTable, entry: CookedDirEntry) error{OutOfMemory}!void {
+        try self.cooked_directories.ensureUnusedCapacity(self.allocator(), 1);
+        self.appendCookedEntryAssumeCapacity(entry);
+    }
+
+    /// Add a new file to the end of the cooked directory, which must have space for it.
+    pub fn appendCookedEntryAssumeCapacity(self: *DirectoryTable, entry: CookedDirEntry) void {
+        self.cooked_directories.appendAssumeCapacity(entry);
+        self.indexCookedEntry(@intCast(self.cooked_directories.items.len - 1));
+    }
+
+    /// Rebuild the filename index. Must be called after cooked_directories is sorted or has entries removed.
+    pub fn reindexCookedEntries(self: *DirectoryTable) void {
+        self.filename_index.clearRetainingCapacity();
+        for (0..self.cooked_directories.items.len) |index| {
+            self.indexCookedEntry(@intCast(index));
+        }
+    }
+
+    fn indexCookedEntry(self: *DirectoryTable, index: u16) void {
+        const entry = &self.cooked_directories.items[index];
+        for ([_]u16{ entry.user, FilenameKey.any_user }) |user| {
+            // Cooked filenames always fit in a key.
+            const result = self.filename_index.getOrPutAssumeCapacity(FilenameKey.init(entry.filenameAndExtension(), user).?);
+            // Keep the first entry in directory order. Entries are indexed in order.
+            if (!result.found_existing) result.value_ptr.* = index;
+        }
+    }
+
+    /// Case-folded filename and user.
+    const FilenameKey = struct {
+        /// Used to look up a filename for any user.
+        const any_user = 0x100;
+
+        name: [CookedDirEntry.filename_max]u8,
+        user: u16,
+
+        fn init(filename: []const u8, user: u16) ?FilenameKey {
+            if (filename.len > CookedDirEntry.filename_max) return null;
+            var key: FilenameKey = .{ .name = @splat(0), .user = user };
+            _ = std.ascii.upperString(key.name[0..filename.len], filename);
+            return key;
+        }
+    };
+
     /// Number of free directory entries
     pub fn rawEntryFreeCount(self: *const DirectoryTable) usize {
         var count: usize = 0;
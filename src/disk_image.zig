@@ -17,6 +17,15 @@ pub const DiskImage = struct {
     image_type: *const DiskImageType,
     directory: DirectoryTable,
     allocator: std.mem.Allocator,
+    /// Optional write-back sector cache. See enableSectorCache()
+    cache: ?SectorCache,
+    /// Directory writes deferred until commit. See beginTransaction()
+    transaction: ?DirectoryTransaction,
+    /// Check the checksum of MITS sectors as they are read from the image.
+    verify_checksums: bool,
+    /// Number of sectors read with a bad checksum while verify_checksums is set.
+    /// Updated atomically, as sectors may be read by several threads.
+    checksum_errors: usize,
 
     /// Initilize a DiskImage from an opened image file.
     /// Image file must at least have read permissions if the loadDirectories() is called.
@@ -29,11 +38,16 @@ pub const DiskImage = struct {
             .image_type = image_type,
             .allocator = gpa,
             .directory = try .init(gpa, image_type),
+            .cache = null,
+            .transaction = null,
+            .verify_checksums = false,
+            .checksum_errors = 0,
         };
     }
 
     /// Close the existing image file and open a new one.
     /// closes any files before an error is returned.
+    /// Any sector cache is discarded, so flush() first if required.
     pub fn reinit(self: *DiskImage, gpa: std.mem.Allocator, reader: SeekableReader, writer: SeekableWriter) !void {
         self.deinit();
         self.allocator = gpa;
@@ -42,10 +56,155 @@ pub const DiskImage = struct {
         self.directory = try .init(gpa, self.image_type);
     }
 
+    /// Switch to another opened image, possibly of a different type, without freeing memory.
+    /// Unlike reinit() the directory table keeps its memory, so loading many images in turn doesn't reallocate.
+    /// Any sector cache is discarded, so flush() first if required.
+    pub fn reuse(self: *DiskImage, reader: SeekableReader, writer: SeekableWriter, image_type: *const DiskImageType) error{OutOfMemory}!void {
+        std.debug.assert(self.transaction == null);
+        if (self.cache) |*cache| cache.clear();
+        self.reader = reader;
+        self.writer = writer;
+        self.image_type = image_type;
+        self.checksum_errors = 0;
+        try self.directory.reset(image_type);
+    }
+
     /// Cleanup.
     /// Caller should close underlying file after calling deinit()
+    /// Any unflushed sectors in the sector cache are lost.
     pub fn deinit(self: *DiskImage) void {
+        if (self.transaction) |*transaction| transaction.dirty_entries.deinit(self.allocator);
+        self.transaction = null;
+        if (self.cache) |*cache| cache.deinit(self.allocator);
+        self.cache = null;
+        self.directory.deinit();
+    }
+
+    /// Write back and discard the sector cache.
+    /// Without a cache, sectors can be read from several threads at once. See readSector()
+    pub fn disableSectorCache(self: *DiskImage) WriteSectorError!void {
+        if (self.cache == null) return;
+        try self.writeBackSectors();
+        self.cache.?.deinit(self.allocator);
+        self.cache = null;
+    }
+
+    /// Cache sectors in memory and defer sector writes until flush() is called.
+    /// Repeated writes to the same sector (e.g. a directory sector) then only result in a single write.
+    /// Note: flush() must be called before deinit() or reinit() to not lose writes.
+    pub fn enableSectorCache(self: *DiskImage, capacity: u16) error{OutOfMemory}!void {
+        if (self.cache != null) return;
+        self.cache = try .init(self.allocator, capacity);
+    }
+
+    /// Raw directory entries and allocation maps that have been changed in memory, but not yet written.
+    pub const DirectoryTransaction = struct {
+        dirty_entries: std.DynamicBitSetUnmanaged,
+        allocation_bitmap_dirty: bool,
+        /// Set while commitTransaction() writes the changes, so they go to the image rather than being deferred again.
+        committing: bool,
+        /// Set when commitTransaction() fails. The changes are kept for the next commit.
+        commit_failed: bool,
+    };
+
+    /// Start deferring directory writes. Until commitTransaction() is called, file data is written
+    /// to the image as normal, but raw directory entries and allocation maps are only updated in memory.
+    /// Returns false if a transaction is already active, in which case the caller joins that
+    /// transaction and must not commit it.
+    /// A transaction that failed to commit is taken over by the caller, so its changes are written by the caller's commit.
+    pub fn beginTransaction(self: *DiskImage) error{OutOfMemory}!bool {
+        if (self.transaction) |*transaction| {
+            if (!transaction.commit_failed) return false;
+            transaction.commit_failed = false;
+            return true;
+        }
+        self.transaction = .{
+            .dirty_entries = try .initEmpty(self.allocator, self.image_type.directories),
+            .allocation_bitmap_dirty = false,
+            .committing = false,
+            .commit_failed = false,
+        };
+        return true;
+    }
+
+    pub const CommitError = (error{ReadOnlySupport} || ReadSectorError || WriteSectorError || RawDirError);
+    /// Write all deferred directory changes. Each changed directory sector is written once.
+    /// The transaction only ends once every write has succeeded. If one fails, all the changes are kept
+    /// and the commit can be retried, or the transaction rolled back.
+    pub fn commitTransaction(self: *DiskImage) CommitError!void {
+        const transaction = if (self.transaction) |*transaction| transaction else return;
+        transaction.committing = true;
+        errdefer {
+            transaction.committing = false;
+            transaction.commit_failed = true;
+        }
+
+        var last_dir_sector: ?usize = null;
+        var itr = transaction.dirty_entries.iterator(.{});
+        while (itr.next()) |entry_nr| {
+            // rawEntryWrite() writes the whole sector containing the entry.
+            const dir_sector = entry_nr / self.image_type.dirs_per_sector;
+            if (last_dir_sector == dir_sector) continue;
+            last_dir_sector = dir_sector;
+            try self.rawEntryWrite(@intCast(entry_nr));
+        }
+        if (transaction.allocation_bitmap_dirty) {
+            try os_hd_basic.writeAllocationBitmap(self);
+            transaction.allocation_bitmap_dirty = false;
+        }
+        transaction.dirty_entries.deinit(self.allocator);
+        self.transaction = null;
+    }
+
+    /// Discard all deferred directory changes and reload the directory from the image,
+    /// leaving the directory as it was before the transaction started.
+    /// Note: Any file data already written is not undone, but is in space that is still free.
+    ///       Any pointers to CookedDirEntries are invalidated.
+    pub fn rollbackTransaction(self: *DiskImage) DirectoryLoadError!void {
+        var transaction = self.transaction orelse return;
+        transaction.dirty_entries.deinit(self.allocator);
+        self.transaction = null;
         self.directory.deinit();
+        self.directory = try .init(self.allocator, self.image_type);
+        try self.loadDirectories(.full);
+    }
+
+    /// Used by the OS specific rawEntryWrite(). Returns true if the write has been deferred until commit.
+    pub fn deferRawEntryWrite(self: *DiskImage, entry_nr: u16) bool {
+        const transaction = if (self.transaction) |*transaction| transaction else return false;
+        if (transaction.committing) return false;
+        transaction.dirty_entries.set(entry_nr);
+        return true;
+    }
+
+    /// Used by writeAllocationBitmap(). Returns true if the write has been deferred until commit.
+    pub fn deferAllocationBitmapWrite(self: *DiskImage) bool {
+        const transaction = if (self.transaction) |*transaction| transaction else return false;
+        if (transaction.committing) return false;
+        transaction.allocation_bitmap_dirty = true;
+        return true;
+    }
+
+    /// Return sector cache hit / miss / write-back counts, if the cache is enabled.
+    pub fn sectorCacheStats(self: *const DiskImage) ?SectorCache.Stats {
+        return if (self.cache) |cache| cache.stats else null;
+    }
+
+    /// Make sure all sector writes have reached the image.
+    /// Must be called before closing a mapped or cached image that has been modified.
+    pub fn flush(self: *DiskImage) (WriteSectorError || MappedImage.FlushError)!void {
+        try self.writeBackSectors();
+        try self.writer.flush();
+    }
+
+    /// Write any dirty sectors in the sector cache to the image, in file order.
+    fn writeBackSectors(self: *DiskImage) WriteSectorError!void {
+        const cache = if (self.cache) |*cache| cache else return;
+        for (cache.dirtySlots(self.image_type)) |slot| {
+            try self.writeSectorAt(slot.location, &slot.sector);
+            slot.dirty = false;
+            cache.stats.writebacks += 1;
+        }
     }
 
     /// Load the directory table.
@@ -88,6 +247,16 @@ pub const DiskImage = struct {
         };
     }
 
+    /// Number of bytes copyFromImage() writes for `entry` in `text_mode`.
+    /// In the exact text mode that is the entry's size, otherwise the file is copied just to count them.
+    pub fn copiedSize(self: *DiskImage, entry: *const CookedDirEntry, text_mode: TextMode) CopyFromImageError!u64 {
+        if (text_mode == self.exactTextMode()) return entry.size_in_bytes;
+        var count_buffer: [256]u8 = undefined;
+        var counter: std.Io.Writer.Discarding = .init(&count_buffer);
+        try self.copyFromImage(entry, &counter.writer, text_mode);
+        return counter.fullCount();
+    }
+
     pub fn rawEntryWrite(self: *DiskImage, raw_entry_nr: u16) (error{ReadOnlySupport} || WriteSectorError || RawDirError)!void {
         try switch (self.image_type.OS) {
             .cpm, .cdos => os_cpm.rawEntryWrite(self, raw_entry_nr),
@@ -173,6 +342,15 @@ pub const DiskImage = struct {
         };
     }
 
+    /// The text mode that copies a file from the image exactly as it is stored.
+    /// The bytes copied always match the entry's size_in_bytes, including for Altair DOS random access files.
+    pub fn exactTextMode(self: *const DiskImage) TextMode {
+        return switch (self.image_type.OS) {
+            .cpm, .cdos => .Binary,
+            .ados, .hd_basic => .Auto,
+        };
+    }
+
     pub fn textModeSupported(self: *const DiskImage, mode: TextMode) bool {
         return std.mem.indexOfScalar(TextMode, self.textModesAllSupported(), mode) != null;
     }
@@ -190,10 +368,28 @@ pub const DiskImage = struct {
         InvalidImageFile,
     } || DiskImage.EraseError);
     /// Copy a file from file_reader to the disk image.
+    /// Unless a transaction is already active, the directory is written once the copy completes.
+    /// If the copy fails, the directory is rolled back instead, so no partial file is kept and its allocations are free again.
+    /// Within a caller's transaction, rolling back a failed copy is up to the caller.
     pub fn copyToImage(self: *DiskImage, file_reader: *std.Io.Reader, to_filename: []const u8, user: ?u8, force: bool, text_mode: TextMode) CopyToImageError!void {
+        return self.copyToImageSized(file_reader, null, to_filename, user, force, text_mode);
+    }
+
+    /// As per copyToImage(), but with the size of the file if it is known in advance.
+    /// For CPM and CDOS, this allows the file to be stored in a single run of contiguous allocations.
+    pub fn copyToImageSized(self: *DiskImage, file_reader: *std.Io.Reader, size: ?u64, to_filename: []const u8, user: ?u8, force: bool, text_mode: TextMode) CopyToImageError!void {
         if (!self.textModeSupported(text_mode)) return error.UnsupportedTextMode;
+        const owns_transaction = try self.beginTransaction();
+        self.copyToImageForOS(file_reader, size, to_filename, user, force, text_mode) catch |err| {
+            if (owns_transaction) self.rollbackFailed();
+            return err;
+        };
+        if (owns_transaction) try self.commitTransaction();
+    }
+
+    fn copyToImageForOS(self: *DiskImage, file_reader: *std.Io.Reader, size: ?u64, to_filename: []const u8, user: ?u8, force: bool, text_mode: TextMode) CopyToImageError!void {
         switch (self.image_type.OS) {
-            .cpm, .cdos => try os_cpm.copyToImage(self, file_reader, to_filename, user, force),
+            .cpm, .cdos => try os_cpm.copyToImage(self, file_reader, size, to_filename, user, force),
             .ados => try os_ados.copyToImage(self, file_reader, to_filename, force, text_mode),
             .hd_basic => {
                 if (self.image_type.type_id == .TIMESHARE_BASIC)
@@ -203,8 +399,9 @@ pub const DiskImage = struct {
         }
     }
 
-    pub const EraseError = (error{ CookedDirEntryNotFound, ReadOnlySupport } || ReadSectorError || WriteSectorError || RawDirError);
+    pub const EraseError = (error{ CookedDirEntryNotFound, ReadOnlySupport, OutOfMemory } || ReadSectorError || WriteSectorError || RawDirError);
     /// Erase a file.
+    /// Unless a transaction is already active, a failed erase is rolled back, leaving the file as it was.
     /// Note that this invalidates any pointers to existing CookedDirEntries
     /// Including any iterators.
     // FUTURE TODO: erase is better implemented in disk_image than directory_table.
@@ -212,7 +409,21 @@ pub const DiskImage = struct {
     pub fn erase(self: *DiskImage, to_erase: *CookedDirEntry) EraseError!void {
         if (self.image_type.type_id == .TIMESHARE_BASIC)
             return error.ReadOnlySupport;
-        return self.directory.eraseEntry(to_erase, self);
+        // Write each directory sector once, rather than once per extent.
+        const owns_transaction = try self.beginTransaction();
+        self.directory.eraseEntry(to_erase, self) catch |err| {
+            if (owns_transaction) self.rollbackFailed();
+            return err;
+        };
+        if (owns_transaction) try self.commitTransaction();
+    }
+
+    /// Roll back a transaction whose operation failed, where the operation's own error is the one to report.
+    /// A failed commit is not rolled back, so that it can be retried.
+    fn rollbackFailed(self: *DiskImage) void {
+        self.rollbackTransaction() catch |err| {
+            logerr("Unable to reload the directory after a failed change: {t}", .{err});
+        };
     }
 
     fn sectorsForTrack(self: *const DiskImage, track_nr: usize) usize {
@@ -222,8 +433,10 @@ pub const DiskImage = struct {
             return self.image_type.sectors_per_track;
     }
 
-    pub const ExtractOperatingSystemError = (error{ InvalidImageFile, WriteFailed } || std.Io.File.Reader.SeekError || std.Io.File.Writer.Error);
+    pub const ExtractOperatingSystemError = (error{ InvalidImageFile, WriteFailed } || std.Io.File.Reader.SeekError || std.Io.File.Writer.Error || WriteSectorError);
     pub fn extractOperatingSystem(self: *DiskImage, io: std.Io, out_file: File) ExtractOperatingSystemError!void {
+        // System tracks are read directly from the image.
+        try self.writeBackSectors();
         try self.reader.seekTo(0);
         var writer = out_file.writer(io, &.{});
 
@@ -263,6 +476,12 @@ pub const DiskImage = struct {
             return error.InvalidImageFile;
         }
 
+        // System tracks are written directly to the image, so the cache is no longer valid.
+        if (self.cache) |*cache| {
+            try self.writeBackSectors();
+            cache.clear();
+        }
+
         var buf: [4096]u8 = undefined;
         var file_reader = in_file.reader(io, &buf);
         // FUTURE TODO: Investigate why these don't work. SendFile mneeds a buffer in the writer, not the reader.
@@ -285,35 +504,63 @@ pub const DiskImage = struct {
         try self.writer.seekTo(0);
     }
 
+    /// Formatted tracks are written to the image in chunks of up to this size.
+    const format_chunk_size = 1024 * 1024;
+
     pub fn formatImage(self: *DiskImage) !void {
         if (self.image_type.type_id == .TIMESHARE_BASIC)
             return error.ReadOnlySupport;
-        var disk_sector: DiskSector = undefined;
-        const varying_sector_format = self.image_type.varying_sector_format;
-
-        if (!varying_sector_format) {
-            disk_sector = .initFormatted(self.image_type, .any);
-        }
+        const image_type = self.image_type;
 
+        // Every sector is about to be overwritten anyway.
+        if (self.cache) |*cache| cache.clear();
         // Just in case formatting an existing image file from larger to smaller format.
         try self.writer.truncate();
 
-        for (0..self.image_type.tracks) |track_nr| {
-            const sectors_per_track = if (track_nr == 0)
-                self.image_type.sectors_per_track0 orelse self.image_type.sectors_per_track
-            else
-                self.image_type.sectors_per_track;
-
-            for (0..sectors_per_track) |sector_nr| {
-                // CPM_MINI formats all tracks as if they are data tracks, but expects the first
-                // 4 tracks to be formatted as system tracks when read from. So we offsetjust do this override for fomatting.
-                const location: PhysicalAddress = .{ .track = @intCast(track_nr), .sector = @intCast(sector_nr) };
-                if (varying_sector_format) {
-                    // Request a new formatted sector for each sector.
-                    disk_sector = .initFormatted(self.image_type, location);
-                }
-                try self.writeSector(location, &disk_sector);
+        // Rather than a seek and write per sector, whole tracks are built in memory
+        // and written sequentially in large chunks.
+        const max_track_size = @max(
+            self.sectorsForTrack(0) * image_type.sectorSizeRawForTrack(0),
+            self.sectorsForTrack(1) * image_type.sectorSizeRawForTrack(1),
+        );
+        const track_buffer = try self.allocator.alloc(u8, max_track_size);
+        defer self.allocator.free(track_buffer);
+        const chunk = try self.allocator.alloc(u8, @min(image_type.image_size, format_chunk_size));
+        defer self.allocator.free(chunk);
+        var chunk_len: usize = 0;
+
+        // If all sectors are formatted the same, tracks of the same size only need to be built once.
+        var built_track_size: ?usize = null;
+        for (0..image_type.tracks) |track_nr| {
+            const track: u16 = @intCast(track_nr);
+            const track_size = self.sectorsForTrack(track_nr) * image_type.sectorSizeRawForTrack(track);
+            if (image_type.varying_sector_format or built_track_size != track_size) {
+                self.buildFormattedTrack(track, track_buffer[0..track_size]);
+                built_track_size = track_size;
             }
+            if (chunk_len + track_size > chunk.len) {
+                try self.writer.interface().writeAll(chunk[0..chunk_len]);
+                chunk_len = 0;
+            }
+            @memcpy(chunk[chunk_len..][0..track_size], track_buffer[0..track_size]);
+            chunk_len += track_size;
+        }
+        try self.writer.interface().writeAll(chunk[0..chunk_len]);
+    }
+
+    /// Build the raw image of a formatted track, with each sector at its skewed position.
+    fn buildFormattedTrack(self: *const DiskImage, track: u16, track_buffer: []u8) void {
+        const image_type = self.image_type;
+        const track_offset = image_type.seekOffset(.{ .track = track, .sector = 0 });
+        for (0..self.sectorsForTrack(track)) |sector_nr| {
+            const location: PhysicalAddress = .{ .track = track, .sector = @intCast(sector_nr) };
+            var disk_sector: DiskSector = if (image_type.varying_sector_format)
+                .initFormatted(image_type, location)
+            else
+                .initFormatted(image_type, .any);
+            disk_sector.prepareWrite(image_type, location);
+            const raw_bytes = disk_sector.rawBytes();
+            @memcpy(track_buffer[image_type.sectorOffset(location) - track_offset ..][0..raw_bytes.len], raw_bytes);
         }
     }
 
@@ -424,6 +671,7 @@ pub const DiskImage = struct {
 
                         delete_related = true;
                         raw_dir.setDeleted();
+                        self.directory.rawEntryFreed(@intCast(i));
                     }
                     try self.rawEntryWrite(@intCast(i));
                 }
@@ -435,33 +683,129 @@ pub const DiskImage = struct {
     }
 
     // Read a single sector using the unskewed track and sector
-    pub const ReadSectorError = Io.Reader.Error || Io.File.Reader.SeekError || PhysicalAddress.ValidateError;
+    // Sectors are read with positional reads, so as long as there is no sector cache and nothing
+    // is writing to the image, readSector() and readSectorBatch() can be called from several threads at once.
+    pub const ReadSectorError = Io.Reader.Error || Io.File.Reader.SeekError || SeekableReader.ReadAtError || PhysicalAddress.ValidateError;
     pub fn readSector(self: *DiskImage, location: PhysicalAddress, sector: *DiskSector) ReadSectorError!void {
         try location.validate(self.image_type);
-        const physical_location: PhysicalAddress = .{ .track = location.track, .sector = self.image_type.skew(location.track, location.sector) };
-        const sector_offset = self.image_type.seekOffset(physical_location);
+        const sector_offset = self.image_type.sectorOffset(location);
+
+        log.debug("Reading from TRACK[{}], LOGICAL[{}], OFFSET[{}]\n", .{ location.track, location.sector, sector_offset });
+
+        if (self.cache) |*cache| {
+            if (cache.get(location)) |slot| {
+                sector.* = slot.sector;
+                return;
+            }
+        }
 
-        log.debug("Reading from TRACK[{}], LOGICAL[{}], PHYSICAL[{}] OFFSET[{}]\n", .{ physical_location.track, location.sector, physical_location.sector, sector_offset });
+        sector.* = .initUnformatted(self.image_type, location.track);
+        try self.reader.readAt(sector_offset, sector.rawBytes());
+        try sector.dump(self.image_type, location, sector_offset);
+        self.verifySector(location, sector);
 
-        try self.reader.seekTo(@intCast(sector_offset));
-        sector.* = .initUnformatted(self.image_type, physical_location.track);
-        try self.reader.interface().readSliceAll(sector.rawBytes());
-        try sector.dump(physical_location, sector_offset);
+        if (self.cache) |*cache| {
+            // If the cache is full of dirty sectors, just don't cache this one.
+            if (cache.reserve(location)) |slot| {
+                slot.sector = sector.*;
+            }
+        }
+    }
+
+    /// Count and warn about a sector just read from the image with a bad checksum.
+    fn verifySector(self: *DiskImage, location: PhysicalAddress, sector: *DiskSector) void {
+        if (!self.verify_checksums or sector.verifyChecksum(self.image_type, location)) return;
+        _ = @atomicRmw(usize, &self.checksum_errors, .Add, 1, .monotonic);
+        log.warn("Bad checksum in TRACK[{}], SECTOR[{}]", .{ location.track, location.sector });
+    }
+
+    /// Maximum number of sectors that can be read with a single readSectorBatch()
+    pub const max_batch_sectors = 32;
+
+    /// Read a batch of sectors using the unskewed tracks and sectors.
+    /// Rather than a seek and read per sector, the sectors are sorted into file order and
+    /// sectors that are close together are read with a single read into `span_buffer`.
+    /// Sectors are returned in the same order as `locations`.
+    pub fn readSectorBatch(self: *DiskImage, locations: []const PhysicalAddress, sectors: []DiskSector, span_buffer: []u8) ReadSectorError!void {
+        std.debug.assert(locations.len <= max_batch_sectors and sectors.len == locations.len);
+        std.debug.assert(span_buffer.len >= DiskSector.sector_size_max);
+
+        var offsets: [max_batch_sectors]usize = undefined;
+        // Index into `locations` of each sector that needs to be read, in file order.
+        var read_order: [max_batch_sectors]u8 = undefined;
+        var read_count: usize = 0;
+
+        for (locations, 0..) |location, i| {
+            try location.validate(self.image_type);
+            offsets[i] = self.image_type.sectorOffset(location);
+            // The cache may hold sectors that are newer than the image.
+            if (self.cache) |*cache| {
+                if (cache.get(location)) |slot| {
+                    sectors[i] = slot.sector;
+                    continue;
+                }
+            }
+            sectors[i] = .initUnformatted(self.image_type, location.track);
+            read_order[read_count] = @intCast(i);
+            read_count += 1;
+        }
+        std.mem.sortUnstable(u8, read_order[0..read_count], @as([]const usize, &offsets), offsetLessThan);
+
+        var span_start: usize = 0;
+        while (span_start < read_count) {
+            const span_offset = offsets[read_order[span_start]];
+            var span_len = sectors[read_order[span_start]].rawBytes().len;
+            var span_end = span_start + 1;
+            while (span_end < read_count) : (span_end += 1) {
+                const i = read_order[span_end];
+                const sector_end = offsets[i] - span_offset + sectors[i].rawBytes().len;
+                if (sector_end > span_buffer.len) break;
+                span_len = @max(span_len, sector_end);
+            }
+
+            log.debug("Reading {} sectors from OFFSET[{}], LENGTH[{}]\n", .{ span_end - span_start, span_offset, span_len });
+            try self.reader.readAt(span_offset, span_buffer[0..span_len]);
+
+            for (read_order[span_start..span_end]) |i| {
+                const raw_bytes = sectors[i].rawBytes();
+                @memcpy(raw_bytes, span_buffer[offsets[i] - span_offset ..][0..raw_bytes.len]);
+                try sectors[i].dump(self.image_type, locations[i], offsets[i]);
+                self.verifySector(locations[i], &sectors[i]);
+            }
+            span_start = span_end;
+        }
+    }
+
+    fn offsetLessThan(offsets: []const usize, lhs: u8, rhs: u8) bool {
+        return offsets[lhs] < offsets[rhs];
     }
 
     pub const WriteSectorError = Io.Writer.Error || File.SeekError || PhysicalAddress.ValidateError;
     /// Write a single sector.
     pub fn writeSector(self: *DiskImage, location: PhysicalAddress, sector: *DiskSector) WriteSectorError!void {
         try location.validate(self.image_type);
-        const physical_location: PhysicalAddress = .{ .track = location.track, .sector = self.image_type.skew(location.track, location.sector) };
-        try physical_location.validate(self.image_type);
         sector.prepareWrite(self.image_type, location);
-        const sector_offset = self.image_type.seekOffset(physical_location);
-        log.debug("Writing to TRACK[{}], SECTOR[{}], OFFSET[{}]\n", .{ physical_location.track, physical_location.sector, sector_offset });
+
+        if (self.cache) |*cache| {
+            const slot = cache.reserve(location) orelse slot: {
+                try self.writeBackSectors();
+                break :slot cache.reserve(location).?;
+            };
+            slot.sector = sector.*;
+            slot.dirty = true;
+            return;
+        }
+        try self.writeSectorAt(location, sector);
+    }
+
+    /// Write an already prepared sector to its skewed location.
+    fn writeSectorAt(self: *DiskImage, location: PhysicalAddress, sector: *DiskSector) WriteSectorError!void {
+        const sector_offset = self.image_type.sectorOffset(location);
+        log.debug("Writing to TRACK[{}], SECTOR[{}], OFFSET[{}]\n", .{ location.track, location.sector, sector_offset });
         try self.writer.seekTo(sector_offset);
         try self.writer.interface().writeAll(sector.rawBytes());
 
-        try sector.dump(physical_location, sector_offset);
+        try sector.dump(self.image_type, location, sector_offset);
     }
 };
 
@@ -469,6 +813,7 @@ pub const DiskImage = struct {
 pub const SeekableReader = union(enum) {
     on_disk: *std.Io.File.Reader,
     in_memory: *std.Io.Reader,
+    mapped: *MappedImage,
 
     pub fn seekTo(self: SeekableReader, offset: u64) File.Reader.SeekError!void {
         switch (self) {
@@ -477,6 +822,10 @@ pub const SeekableReader = union(enum) {
                 std.debug.assert(offset <= mem.buffer.len);
                 mem.seek = @intCast(offset);
             },
+            .mapped => |map| {
+                std.debug.assert(offset <= map.memory.len);
+                map.reader.seek = @intCast(offset);
+            },
         }
     }
 
@@ -484,6 +833,33 @@ pub const SeekableReader = union(enum) {
         return switch (self) {
             .on_disk => |file| file.logicalPos(),
             .in_memory => |mem| mem.seek,
+            .mapped => |map| map.reader.seek,
+        };
+    }
+
+    pub const ReadAtError = error{EndOfStream} || File.ReadPositionalError;
+    /// Fill `buffer` from `offset` without using or moving the seek position.
+    /// Safe to call from several threads at once.
+    pub fn readAt(self: SeekableReader, offset: u64, buffer: []u8) ReadAtError!void {
+        const memory = switch (self) {
+            .on_disk => |file| {
+                const nbytes = try file.file.readPositionalAll(file.io, buffer, offset);
+                if (nbytes < buffer.len) return error.EndOfStream;
+                return;
+            },
+            .in_memory => |mem| mem.buffer[0..mem.end],
+            .mapped => |map| map.memory,
+        };
+        if (offset + buffer.len > memory.len) return error.EndOfStream;
+        @memcpy(buffer, memory[@intCast(offset)..][0..buffer.len]);
+    }
+
+    /// The whole image, if it is already in memory.
+    pub fn memory(self: SeekableReader) ?[]const u8 {
+        return switch (self) {
+            .on_disk => null,
+            .in_memory => |mem| mem.buffer[0..mem.end],
+            .mapped => |map| map.memory,
         };
     }
 
@@ -491,6 +867,7 @@ pub const SeekableReader = union(enum) {
         return switch (self) {
             .on_disk => |file| &file.interface,
             .in_memory => |mem| mem,
+            .mapped => |map| &map.reader,
         };
     }
 };
@@ -499,6 +876,7 @@ pub const SeekableReader = union(enum) {
 pub const SeekableWriter = union(enum) {
     on_disk: *std.Io.File.Writer,
     in_memory: *std.Io.Writer,
+    mapped: *MappedImage,
 
     pub fn seekTo(self: SeekableWriter, offset: u64) (File.Writer.SeekError || Io.Writer.Error)!void {
         switch (self) {
@@ -507,6 +885,10 @@ pub const SeekableWriter = union(enum) {
                 std.debug.assert(offset <= mem.buffer.len);
                 mem.end = @intCast(offset);
             },
+            .mapped => |map| {
+                std.debug.assert(offset <= map.memory.len);
+                map.writer.end = @intCast(offset);
+            },
         }
     }
 
@@ -514,6 +896,7 @@ pub const SeekableWriter = union(enum) {
         return switch (self) {
             .on_disk => |file| file.logicalPos(),
             .in_memory => |mem| mem.end,
+            .mapped => |map| map.writer.end,
         };
     }
 
@@ -521,6 +904,7 @@ pub const SeekableWriter = union(enum) {
         return switch (self) {
             .on_disk => |file| &file.interface,
             .in_memory => |mem| mem,
+            .mapped => |map| &map.writer,
         };
     }
 
@@ -533,11 +917,149 @@ pub const SeekableWriter = union(enum) {
             .in_memory => |mem| {
                 mem.end = 0;
             },
+            // A mapping can't change size, so just rewind.
+            .mapped => |map| {
+                map.writer.end = 0;
+            },
         };
     }
+
+    /// Make sure all writes have reached the underlying image.
+    pub fn flush(self: SeekableWriter) (Io.Writer.Error || MappedImage.FlushError)!void {
+        return switch (self) {
+            .on_disk => |file| file.interface.flush(),
+            .in_memory => {},
+            .mapped => |map| map.flush(),
+        };
+    }
+};
+
+/// A disk image file read entirely into memory.
+/// Use the reader and writer with the .in_memory SeekableReader and SeekableWriter,
+/// then writeBack() to write only the parts of the image that have changed.
+pub const LoadedImage = struct {
+    buffer: []u8,
+    /// Image contents as of the last load or write back. Used to find modified ranges.
+    original: []u8,
+    reader: std.Io.Reader,
+    writer: std.Io.Writer,
+
+    /// Granularity of modified ranges.
+    const chunk_size = 4096;
+
+    pub const InitError = (error{ InvalidImageFile, OutOfMemory } || File.LengthError || File.Reader.Error);
+    /// Read the whole image file. The file must be exactly image_type.image_size bytes.
+    /// Note: Caller is responsible for closing the underlying file after deinit()
+    pub fn init(self: *LoadedImage, gpa: std.mem.Allocator, io: Io, file: File, image_type: *const DiskImageType) InitError!void {
+        const length = try file.length(io);
+        if (length != image_type.image_size) return error.InvalidImageFile;
+
+        self.buffer = try gpa.alloc(u8, image_type.image_size);
+        errdefer gpa.free(self.buffer);
+        self.original = try gpa.alloc(u8, image_type.image_size);
+        errdefer gpa.free(self.original);
+
+        var file_reader = file.reader(io, &.{});
+        file_reader.interface.readSliceAll(self.buffer) catch |err| switch (err) {
+            error.ReadFailed => return file_reader.err.?,
+            error.EndOfStream => return error.InvalidImageFile,
+        };
+        @memcpy(self.original, self.buffer);
+        self.reader = .fixed(self.buffer);
+        self.writer = .fixed(self.buffer);
+    }
+
+    pub fn deinit(self: *LoadedImage, gpa: std.mem.Allocator) void {
+        gpa.free(self.original);
+        gpa.free(self.buffer);
+        self.* = undefined;
+    }
+
+    pub const WriteBackError = (File.Writer.SeekError || File.Writer.Error);
+    /// Write any modified ranges back to the image file.
+    /// Returns the number of bytes written.
+    pub fn writeBack(self: *LoadedImage, io: Io, file: File) WriteBackError!usize {
+        var file_writer = file.writer(io, &.{});
+        var bytes_written: usize = 0;
+        var offset: usize = 0;
+        while (offset < self.buffer.len) {
+            while (offset < self.buffer.len and !self.chunkModified(offset)) {
+                offset += chunk_size;
+            }
+            if (offset >= self.buffer.len) break;
+            const run_start = offset;
+            while (offset < self.buffer.len and self.chunkModified(offset)) {
+                offset += chunk_size;
+            }
+            const run_end = @min(offset, self.buffer.len);
+
+            log.debug("Writing back OFFSET[{}], LENGTH[{}]\n", .{ run_start, run_end - run_start });
+            try file_writer.seekTo(run_start);
+            file_writer.interface.writeAll(self.buffer[run_start..run_end]) catch |err| switch (err) {
+                error.WriteFailed => return file_writer.err.?,
+            };
+            @memcpy(self.original[run_start..run_end], self.buffer[run_start..run_end]);
+            bytes_written += run_end - run_start;
+        }
+        return bytes_written;
+    }
+
+    fn chunkModified(self: *const LoadedImage, offset: usize) bool {
+        const end = @min(offset + chunk_size, self.buffer.len);
+        return !std.mem.eql(u8, self.buffer[offset..end], self.original[offset..end]);
+    }
+};
+
+/// A disk image file mapped into memory.
+/// Sector reads and writes become copies to and from the mapping instead of
+/// a seek plus read / write syscall per sector.
+/// Writes are only guaranteed to have reached the file after flush().
+pub const MappedImage = struct {
+    memory: []align(std.heap.page_size_min) u8,
+    reader: std.Io.Reader,
+    writer: std.Io.Writer,
+
+    pub const supported = switch (builtin.os.tag) {
+        .windows, .wasi => false,
+        else => true,
+    };
+
+    pub const InitError = error{ MappingNotSupported, InvalidImageFile } || std.posix.MMapError || File.LengthError;
+    pub const FlushError = std.posix.MSyncError;
+
+    /// Map an opened image file. The file must already be exactly image_type.image_size bytes.
+    /// If not `writeable` the mapping is private, so any writes are never seen by the file.
+    /// Note: Caller is responsible for closing the underlying file after deinit()
+    pub fn init(self: *MappedImage, io: Io, file: File, image_type: *const DiskImageType, writeable: bool) InitError!void {
+        if (!supported) return error.MappingNotSupported;
+        const length = try file.length(io);
+        if (length != image_type.image_size) return error.InvalidImageFile;
+
+        self.memory = try std.posix.mmap(
+            null,
+            image_type.image_size,
+            std.posix.PROT.READ | std.posix.PROT.WRITE,
+            .{ .TYPE = if (writeable) .SHARED else .PRIVATE },
+            file.handle,
+            0,
+        );
+        self.reader = .fixed(self.memory);
+        self.writer = .fixed(self.memory);
+    }
+
+    pub fn deinit(self: *MappedImage) void {
+        std.posix.munmap(self.memory);
+        self.* = undefined;
+    }
+
+    /// Write any modified pages back to the image file.
+    pub fn flush(self: *MappedImage) FlushError!void {
+        try std.posix.msync(self.memory, std.posix.MSF.SYNC);
+    }
 };
 
 const std = @import("std");
+const builtin = @import("builtin");
 const Console = @import("console.zig");
 const disk_types = @import("disk_types.zig");
 const basic_file_decoder = @import("basic_file_decoder.zig");
@@ -546,6 +1068,7 @@ const PhysicalAddress = disk_types.PhysicalAddress;
 const DiskSector = disk_types.DiskSector;
 const DiskLabel = disk_types.DiskLabel;
 const DirectoryTable = @import("directory_table.zig").DirectoryTable;
+const SectorCache = @import("sector_cache.zig");
 const CookedDirEntry = @import("directory_table.zig").CookedDirEntry;
 const DirectoryLoadError = DirectoryTable.DirectoryLoadError;
 const RawDirError = DirectoryTable.RawDirError;
@@ -451,6 +451,194 @@ test "8in Binary file" {
     try std.testing.expectEqualSlices(u8, &compare_buffer, &in_file);
 }
 
+test "memory mapped image" {
+    if (!MappedImage.supported) return error.SkipZigTest;
+    var test_file = "Ain't got no distractions, can't hear no buzzes and bells. Don't see no lights a-flashing, plays by sense of smell. Always gets the replay, never seen him fall".*;
+    var test_stream: std.Io.Reader = .fixed(&test_file);
+
+    var file_reader: std.Io.File.Reader = undefined;
+    var file_writer: std.Io.File.Writer = undefined;
+    var disk_image = try newPhysicalDiskImage(&file_reader, &file_writer, FDD_8IN);
+    defer disk_image.deinit();
+    defer file_reader.file.close(io);
+
+    var mapped: MappedImage = undefined;
+    try mapped.init(io, file_reader.file, FDD_8IN, true);
+    defer mapped.deinit();
+    var mapped_image = try DiskImage.init(allocator, .{ .mapped = &mapped }, .{ .mapped = &mapped }, FDD_8IN);
+    defer mapped_image.deinit();
+    try mapped_image.loadDirectories(.full);
+    try mapped_image.copyToImage(&test_stream, "PINBALL.TXT", 0, false, .Auto);
+    try mapped_image.flush();
+
+    // Once flushed, the file should be visible when read through the file.
+    try reinitDiskImage(&disk_image);
+    var in_file: [test_file.len]u8 = undefined;
+    var in_stream: std.Io.Writer = .fixed(&in_file);
+    const cooked_dir = disk_image.directory.findByFilename("PINBALL.TXT", null);
+    try std.testing.expect(cooked_dir != null);
+    try disk_image.copyFromImage(cooked_dir.?, &in_stream, .Text);
+    try std.testing.expectEqualSlices(u8, &test_file, &in_file);
+}
+
+test "sector cache" {
+    var test_file: [200 * 1024]u8 = undefined;
+    for (&test_file, 0..) |*b, i| b.* = @truncate(i);
+    var test_stream: std.Io.Reader = .fixed(&test_file);
+
+    const image_file = try allocator.alloc(u8, HDD_5MB.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, HDD_5MB);
+    defer disk_image.deinit();
+
+    const formatted = try allocator.dupe(u8, image_file);
+    defer allocator.free(formatted);
+
+    try disk_image.enableSectorCache(SectorCache.default_capacity);
+    try disk_image.copyToImage(&test_stream, "BIG.BIN", 0, false, .Auto);
+    try disk_image.flush();
+
+    // Without the cache, each data sector write is followed by a directory sector write.
+    const data_sectors = test_file.len / HDD_5MB.sector_size_data;
+    try std.testing.expect(disk_image.sectorCacheStats().?.writebacks < data_sectors + 10);
+    try std.testing.expect(!std.mem.eql(u8, formatted, image_file));
+
+    try reinitDiskImage(&disk_image);
+    const out_buf = try allocator.alloc(u8, test_file.len);
+    defer allocator.free(out_buf);
+    var out_stream: std.Io.Writer = .fixed(out_buf);
+    const cooked_dir = disk_image.directory.findByFilename("BIG.BIN", null);
+    try std.testing.expect(cooked_dir != null);
+    try disk_image.copyFromImage(cooked_dir.?, &out_stream, .Binary);
+    try std.testing.expectEqualSlices(u8, &test_file, out_buf);
+}
+
+test "directory transactions" {
+    inline for (all_formats) |fmt| {
+        if (fmt.type_id == .TIMESHARE_BASIC) continue;
+        std.log.info("Testing transactions for: {t}", .{fmt.type_id});
+        const in_file: [1000]u8 = @splat('T');
+        var in_reader: std.Io.Reader = .fixed(&in_file);
+
+        const image_buf = try allocator.alloc(u8, fmt.image_size);
+        defer allocator.free(image_buf);
+        var image_file: InMemoryImage = undefined;
+        image_file.init(image_buf);
+        var disk_image = try newFormattedMemoryDiskImage(&image_file, fmt);
+        defer disk_image.deinit();
+
+        const free_allocs = disk_image.directory.free_allocations.count();
+        const free_entries = disk_image.directory.rawEntryFreeCount();
+
+        // A copy that fails is rolled back, rather than leaving a partial file.
+        const too_big = try allocator.alloc(u8, fmt.image_size);
+        defer allocator.free(too_big);
+        @memset(too_big, 'T');
+        var too_big_reader: std.Io.Reader = .fixed(too_big);
+        if (disk_image.copyToImage(&too_big_reader, "TOOBIG", null, false, .Auto)) |_| {
+            return error.TestUnexpectedResult;
+        } else |_| {}
+        try std.testing.expectEqual(null, disk_image.directory.findByFilename("TOOBIG", null));
+        try std.testing.expectEqual(free_allocs, disk_image.directory.free_allocations.count());
+        try std.testing.expectEqual(free_entries, disk_image.directory.rawEntryFreeCount());
+
+        // A rolled back copy leaves the directory as it was.
+        try std.testing.expect(try disk_image.beginTransaction());
+        try disk_image.copyToImage(&in_reader, "ROLLBACK", null, false, .Auto);
+        try std.testing.expect(disk_image.directory.findByFilename("ROLLBACK", null) != null);
+        try disk_image.rollbackTransaction();
+        try std.testing.expectEqual(null, disk_image.directory.findByFilename("ROLLBACK", null));
+        try std.testing.expectEqual(free_allocs, disk_image.directory.free_allocations.count());
+        try std.testing.expectEqual(free_entries, disk_image.directory.rawEntryFreeCount());
+
+        // Multiple files in a committed transaction are all written.
+        try std.testing.expect(try disk_image.beginTransaction());
+        in_reader.seek = 0;
+        try disk_image.copyToImage(&in_reader, "FIL0", null, false, .Auto);
+        in_reader.seek = 0;
+        try disk_image.copyToImage(&in_reader, "FIL1", null, false, .Auto);
+        try disk_image.commitTransaction();
+
+        try reinitDiskImage(&disk_image);
+        try std.testing.expectEqual(null, disk_image.directory.findByFilename("ROLLBACK", null));
+        try std.testing.expect(disk_image.directory.findByFilename("FIL0", null) != null);
+        try std.testing.expect(disk_image.directory.findByFilename("FIL1", null) != null);
+    }
+}
+
+test "in memory image write back" {
+    const in_file: [129]u8 = @splat('T');
+    var in_reader: std.Io.Reader = .fixed(&in_file);
+
+    var file_reader: std.Io.File.Reader = undefined;
+    var file_writer: std.Io.File.Writer = undefined;
+    var disk_image = try newPhysicalDiskImage(&file_reader, &file_writer, FDD_8IN);
+    defer disk_image.deinit();
+    defer file_reader.file.close(io);
+
+    var loaded: LoadedImage = undefined;
+    try loaded.init(allocator, io, file_reader.file, FDD_8IN);
+    defer loaded.deinit(allocator);
+    var loaded_image = try DiskImage.init(allocator, .{ .in_memory = &loaded.reader }, .{ .in_memory = &loaded.writer }, FDD_8IN);
+    defer loaded_image.deinit();
+    try loaded_image.loadDirectories(.full);
+    try loaded_image.copyToImage(&in_reader, "SMALL.TXT", 0, false, .Auto);
+
+    // Only the changed directory and data ranges should be written.
+    const nbytes = try loaded.writeBack(io, file_reader.file);
+    try std.testing.expect(nbytes > 0 and nbytes < FDD_8IN.image_size / 4);
+    try std.testing.expectEqual(0, try loaded.writeBack(io, file_reader.file));
+
+    try reinitDiskImage(&disk_image);
+    try std.testing.expect(disk_image.directory.findByFilename("SMALL.TXT", null) != null);
+}
+
+test "sector checksums" {
+    var prng: std.Random.DefaultPrng = .init(0x8080);
+    var block: [128]u8 = undefined;
+    for (0..100) |_| {
+        prng.random().bytes(&block);
+        try std.testing.expectEqual(DiskSector.sumBytesScalar(&block), DiskSector.sumBytes(&block));
+    }
+
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    defer disk_image.deinit();
+    disk_image.verify_checksums = true;
+
+    // Both a system (.reserved) and a data (.data) track.
+    var sector: DiskSector = undefined;
+    for ([_]u16{ 2, 10 }) |track| {
+        const location: PhysicalAddress = .{ .track = track, .sector = 0 };
+        try disk_image.readSector(location, &sector);
+        try std.testing.expectEqual(0, disk_image.checksum_errors);
+
+        image_file[FDD_8IN.sectorOffset(location) + 10] ^= 0xff;
+        try disk_image.readSector(location, &sector);
+        try std.testing.expectEqual(1, disk_image.checksum_errors);
+        disk_image.checksum_errors = 0;
+    }
+}
+
+test "sector offset tables" {
+    inline for (all_formats) |fmt| {
+        for (0..fmt.tracks) |track_nr| {
+            const track: u16 = @intCast(track_nr);
+            for (0..fmt.sectorsForTrack(track)) |sector_nr| {
+                const location: PhysicalAddress = .{ .track = track, .sector = @intCast(sector_nr) };
+                const physical_location: PhysicalAddress = .{ .track = track, .sector = fmt.skew(track, location.sector) };
+                try std.testing.expectEqual(fmt.seekOffset(physical_location), fmt.sectorOffset(location));
+                try std.testing.expect(fmt.sectorOffset(location) + fmt.sectorSizeRawForTrack(track) <= fmt.image_size);
+            }
+        }
+    }
+}
+
 test "8in Auto detect file type" {
     // TODO: embed a test file with bin and ascii in it and get both.
 
@@ -476,6 +664,12 @@ test "Altair DOS random access file" {
     try std.testing.expect(cooked_dir != null);
     try disk_image.copyFromImage(cooked_dir.?, &in_stream, .Rand);
     try std.testing.expectEqualSlices(u8, &test_file, &in_file);
+    // The size doesn't include the group map, so it matches what is copied and hashed in the exact text mode.
+    try std.testing.expectEqual(test_file.len, cooked_dir.?.size_in_bytes);
+    try std.testing.expectEqual(test_file.len, (try FileHash.hashFile(&disk_image, cooked_dir.?)).size);
+    // As used for the size in the header of each file exported to a tar archive.
+    try std.testing.expectEqual(test_file.len, try disk_image.copiedSize(cooked_dir.?, disk_image.exactTextMode()));
+    try std.testing.expectEqual(test_file.len, try disk_image.copiedSize(cooked_dir.?, .Rand));
 
     var in_file2: [1024 - 256]u8 = undefined;
     var in_stream2: std.Io.Writer = .fixed(&in_file2);
@@ -542,6 +736,39 @@ test "Multiple filenames across users" {
     try std.testing.expect(disk_image.directory.findByFilename("SOMETHIN.EXT.", null) != null);
 }
 
+test "filename index" {
+    const image_file = try allocator.alloc(u8, HDD_5MB_1024.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, HDD_5MB_1024);
+    defer disk_image.deinit();
+
+    const nfiles = 300;
+    var name_buf: [16]u8 = undefined;
+    for (0..nfiles) |i| {
+        var empty_stream: std.Io.Reader = .fixed("");
+        try disk_image.copyToImage(&empty_stream, try std.fmt.bufPrint(&name_buf, "F{d}.TXT", .{i}), @intCast(i % 3), false, .Binary);
+    }
+    // Erase every second file, which reorders the cooked directory.
+    for (0..nfiles) |i| {
+        if (i % 2 == 1) continue;
+        const entry = disk_image.directory.findByFilename(try std.fmt.bufPrint(&name_buf, "f{d}.txt", .{i}), @intCast(i % 3));
+        try std.testing.expect(entry != null);
+        try disk_image.erase(entry.?);
+    }
+    for (0..nfiles) |i| {
+        const filename = try std.fmt.bufPrint(&name_buf, "f{d}.TxT", .{i});
+        const entry = disk_image.directory.findByFilename(filename, null);
+        try std.testing.expectEqual(i % 2 == 1, entry != null);
+        if (entry) |e| {
+            try std.testing.expectEqual(i % 3, e.user);
+            try std.testing.expectEqual(e, disk_image.directory.findByFilename(filename, @intCast(i % 3)).?);
+            try std.testing.expectEqual(null, disk_image.directory.findByFilename(filename, @intCast((i + 1) % 3)));
+        }
+    }
+}
+
 test "Find filename with wildcards" {
     // Name     Ext   Length Used U At
     // FILE     COM     128B   2K 0 W
@@ -690,6 +917,583 @@ test "disk erase" {
     }
 }
 
+test "free entry and allocation reuse" {
+    inline for (.{ FDD_8IN, HDD_5MB }) |fmt| {
+        const image_file = try allocator.alloc(u8, fmt.image_size);
+        defer allocator.free(image_file);
+        var test_image: InMemoryImage = undefined;
+        test_image.init(image_file);
+        var disk_image = try newFormattedMemoryDiskImage(&test_image, fmt);
+        defer disk_image.deinit();
+
+        const contents: [100]u8 = @splat('A');
+        for ([_][]const u8{ "ONE", "TWO", "THREE" }) |filename| {
+            var contents_stream: std.Io.Reader = .fixed(&contents);
+            try disk_image.copyToImage(&contents_stream, filename, 0, false, .Binary);
+        }
+        const erased_alloc = disk_image.directory.findByFilename("ONE", 0).?.allocations.items[0];
+        try disk_image.erase(disk_image.directory.findByFilename("ONE", 0).?);
+
+        // The lowest free allocation is used again, even though later ones have been allocated since.
+        var contents_stream: std.Io.Reader = .fixed(&contents);
+        try disk_image.copyToImage(&contents_stream, "FOUR", 0, false, .Binary);
+        try std.testing.expectEqual(erased_alloc, disk_image.directory.findByFilename("FOUR", 0).?.allocations.items[0]);
+
+        try reinitDiskImage(&disk_image);
+        try std.testing.expect(disk_image.directory.findByFilename("FOUR", 0) != null);
+        try std.testing.expect(disk_image.directory.findByFilename("THREE", 0) != null);
+    }
+}
+
+test "contiguous allocation runs" {
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    defer disk_image.deinit();
+
+    // Leave a one allocation and a three allocation hole.
+    const contents: [3 * 2048]u8 = @splat('C');
+    var name_buf: [16]u8 = undefined;
+    var first_allocs: [8]u16 = undefined;
+    for (0..first_allocs.len) |i| {
+        var contents_stream: std.Io.Reader = .fixed(contents[0..FDD_8IN.block_size]);
+        const filename = try std.fmt.bufPrint(&name_buf, "F{d}", .{i});
+        try disk_image.copyToImage(&contents_stream, filename, 0, false, .Binary);
+        first_allocs[i] = disk_image.directory.findByFilename(filename, 0).?.allocations.items[0];
+    }
+    for ([_]u8{ 1, 3, 4, 5 }) |i| {
+        try disk_image.erase(disk_image.directory.findByFilename(try std.fmt.bufPrint(&name_buf, "F{d}", .{i}), 0).?);
+    }
+    try std.testing.expectEqual(0, disk_image.directory.fragmentation().fragmented_files);
+    try std.testing.expectEqual(3, disk_image.directory.fragmentation().free_runs);
+
+    // With the size known, the file goes in the three allocation hole.
+    var contents_stream: std.Io.Reader = .fixed(&contents);
+    try disk_image.copyToImageSized(&contents_stream, contents.len, "SIZED", 0, false, .Binary);
+    const sized = disk_image.directory.findByFilename("SIZED", 0).?;
+    try std.testing.expectEqual(first_allocs[3], sized.allocations.items[0]);
+    try std.testing.expectEqual(first_allocs[5], sized.allocations.items[2]);
+    try std.testing.expectEqual(0, disk_image.directory.fragmentation().fragmented_files);
+
+    // Without the size, the first free allocations are used.
+    contents_stream = .fixed(&contents);
+    try disk_image.copyToImage(&contents_stream, "UNSIZED", 0, false, .Binary);
+    try std.testing.expectEqual(first_allocs[1], disk_image.directory.findByFilename("UNSIZED", 0).?.allocations.items[0]);
+    try std.testing.expectEqual(1, disk_image.directory.fragmentation().fragmented_files);
+}
+
+test "reuse disk image" {
+    const cpm_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(cpm_file);
+    var cpm_image: InMemoryImage = undefined;
+    cpm_image.init(cpm_file);
+    var disk_image = try newFormattedMemoryDiskImage(&cpm_image, FDD_8IN);
+    defer disk_image.deinit();
+    var contents_stream: std.Io.Reader = .fixed("CPM FILE");
+    try disk_image.copyToImage(&contents_stream, "CPM.TXT", 0, false, .Binary);
+
+    const ados_file = try allocator.alloc(u8, ADOS_8IN.image_size);
+    defer allocator.free(ados_file);
+    var ados_image: InMemoryImage = undefined;
+    ados_image.init(ados_file);
+    {
+        var ados_disk = try newFormattedMemoryDiskImage(&ados_image, ADOS_8IN);
+        defer ados_disk.deinit();
+        contents_stream = .fixed("ADOS FILE");
+        try ados_disk.copyToImage(&contents_stream, "ADOS", null, false, .Auto);
+        contents_stream = .fixed("ADOS FILE");
+        try ados_disk.copyToImage(&contents_stream, "ADOS2", null, false, .Auto);
+    }
+
+    // Switch to an image of a different OS, then back again.
+    try disk_image.reuse(.{ .in_memory = &ados_image.reader }, .{ .in_memory = &ados_image.writer }, ADOS_8IN);
+    try disk_image.loadDirectories(.full);
+    try std.testing.expectEqual(2, disk_image.directory.cooked_directories.items.len);
+    try std.testing.expect(disk_image.directory.findByFilename("ADOS2", null) != null);
+    try std.testing.expect(disk_image.directory.findByFilename("CPM.TXT", null) == null);
+
+    try disk_image.reuse(.{ .in_memory = &cpm_image.reader }, .{ .in_memory = &cpm_image.writer }, FDD_8IN);
+    try disk_image.loadDirectories(.full);
+    try std.testing.expectEqual(1, disk_image.directory.cooked_directories.items.len);
+    try std.testing.expect(disk_image.directory.findByFilename("CPM.TXT", 0) != null);
+    try std.testing.expectEqual(FDD_8IN.directories - 1, disk_image.directory.rawEntryFreeCount());
+}
+
+test "concurrent reads" {
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    defer disk_image.deinit();
+
+    const file_count = 8;
+    var contents: [file_count][5000]u8 = undefined;
+    var name_buf: [16]u8 = undefined;
+    for (&contents, 0..) |*file_contents, i| {
+        @memset(file_contents, @intCast('A' + i));
+        var contents_stream: std.Io.Reader = .fixed(file_contents);
+        try disk_image.copyToImage(&contents_stream, try std.fmt.bufPrint(&name_buf, "F{d}", .{i}), 0, false, .Binary);
+    }
+
+    const Reader = struct {
+        fn readAll(image: *DiskImage, expected: *const [file_count][5000]u8) !void {
+            var name: [16]u8 = undefined;
+            for (expected, 0..) |*file_contents, i| {
+                const entry = image.directory.findByFilename(try std.fmt.bufPrint(&name, "F{d}", .{i}), 0).?;
+                var out: [file_contents.len + FDD_8IN.block_size]u8 = undefined;
+                var out_stream: std.Io.Writer = .fixed(&out);
+                try image.copyFromImage(entry, &out_stream, .Binary);
+                try std.testing.expectEqualSlices(u8, file_contents, out_stream.buffered()[0..file_contents.len]);
+            }
+        }
+        fn run(image: *DiskImage, expected: *const [file_count][5000]u8, result: *anyerror!void) void {
+            result.* = readAll(image, expected);
+        }
+    };
+    var results: [4]anyerror!void = undefined;
+    var threads: [results.len]std.Thread = undefined;
+    for (&threads, &results) |*thread, *result| {
+        thread.* = try std.Thread.spawn(.{}, Reader.run, .{ &disk_image, &contents, result });
+    }
+    for (threads) |thread| thread.join();
+    for (results) |result| try result;
+}
+
+test "tar writer" {
+    var archive: [16 * 512]u8 = undefined;
+    var archive_writer: std.Io.Writer = .fixed(&archive);
+    var tar: TarWriter = .init(&archive_writer);
+    try tar.writeGlobalHeader(&.{.{ "ALTAIRDSK.text_mode", "Auto" }});
+    try tar.writeFileHeader("0/STAT.COM", 5, TarWriter.mtimeFromDate(.{ 77, 5, 6 }));
+    try archive_writer.writeAll("HELLO");
+    try tar.endFile(5);
+    // Contents shorter or longer than the header are padded or truncated.
+    var contents_buffer: [4]u8 = undefined;
+    try tar.writeFileHeader("0/SHORT.TXT", 5, 0);
+    var short = tar.fileWriter(5, &contents_buffer);
+    try short.interface.writeAll("AB");
+    try tar.endFileWriter(&short);
+    try tar.writeFileHeader("0/LONG.TXT", 5, 0);
+    var long = tar.fileWriter(5, &contents_buffer);
+    try std.testing.expectError(error.WriteFailed, long.interface.writeAll("ABCDEFGH"));
+    try std.testing.expect(long.too_long);
+    try tar.endFileWriter(&long);
+    try tar.finish();
+    try std.testing.expectEqual(0, archive_writer.end % 512);
+
+    var archive_reader: std.Io.Reader = .fixed(archive_writer.buffered());
+    var file_name_buffer: [std.fs.max_path_bytes]u8 = undefined;
+    var link_name_buffer: [std.fs.max_path_bytes]u8 = undefined;
+    var iterator: std.tar.Iterator = .init(&archive_reader, .{ .file_name_buffer = &file_name_buffer, .link_name_buffer = &link_name_buffer });
+    const file = (try iterator.next()).?;
+    try std.testing.expectEqualStrings("0/STAT.COM", file.name);
+    try std.testing.expectEqual(5, file.size);
+    var contents: [5]u8 = undefined;
+    var contents_writer: std.Io.Writer = .fixed(&contents);
+    try iterator.streamRemaining(file, &contents_writer);
+    try std.testing.expectEqualStrings("HELLO", &contents);
+    for ([_][]const u8{ "AB\x00\x00\x00", "ABCDE" }) |expected| {
+        const padded = (try iterator.next()).?;
+        try std.testing.expectEqual(5, padded.size);
+        contents_writer = .fixed(&contents);
+        try iterator.streamRemaining(padded, &contents_writer);
+        try std.testing.expectEqualStrings(expected, &contents);
+    }
+    try std.testing.expectEqual(null, try iterator.next());
+    // 1977-05-06
+    try std.testing.expectEqual(231724800, TarWriter.mtimeFromDate(.{ 77, 5, 6 }));
+}
+
+test "image diff" {
+    const old_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(old_file);
+    var old_image: InMemoryImage = undefined;
+    old_image.init(old_file);
+    var old_disk = try newFormattedMemoryDiskImage(&old_image, FDD_8IN);
+    defer old_disk.deinit();
+    for ([_][]const u8{ "SAME.TXT", "GONE.TXT", "EDIT.TXT" }) |filename| {
+        var contents_stream: std.Io.Reader = .fixed("ORIGINAL");
+        try old_disk.copyToImage(&contents_stream, filename, 0, false, .Binary);
+    }
+
+    const new_file = try allocator.dupe(u8, old_file);
+    defer allocator.free(new_file);
+    var new_image: InMemoryImage = undefined;
+    new_image.init(new_file);
+    var new_disk = try DiskImage.init(allocator, .{ .in_memory = &new_image.reader }, .{ .in_memory = &new_image.writer }, FDD_8IN);
+    defer new_disk.deinit();
+    try new_disk.loadDirectories(.full);
+
+    {
+        var same = try ImageDiff.compare(allocator, &old_disk, &new_disk);
+        defer same.deinit(allocator);
+        try std.testing.expectEqual(0, same.files.items.len);
+        try std.testing.expectEqual(0, same.sectors);
+    }
+
+    try new_disk.erase(new_disk.directory.findByFilename("GONE.TXT", 0).?);
+    // Overwrite EDIT.TXT in place, without changing its directory entry.
+    const edit_allocation = new_disk.directory.findByFilename("EDIT.TXT", 0).?.allocations.items[0];
+    const edit_offset = FDD_8IN.sectorOffset(.{ .track = FDD_8IN.reserved_tracks + edit_allocation * FDD_8IN.sectors_per_alloc / FDD_8IN.sectors_per_track, .sector = edit_allocation * FDD_8IN.sectors_per_alloc % FDD_8IN.sectors_per_track });
+    @memcpy(new_file[edit_offset + 7 ..][0..7], "CHANGED");
+    var contents_stream: std.Io.Reader = .fixed("NEW FILE");
+    try new_disk.copyToImage(&contents_stream, "NEW.TXT", 0, false, .Binary);
+
+    var diff = try ImageDiff.compare(allocator, &old_disk, &new_disk);
+    defer diff.deinit(allocator);
+    try std.testing.expectEqual(3, diff.files.items.len);
+    for (diff.files.items) |file| {
+        const filename = file.entry.filenameAndExtension();
+        const expected: ImageDiff.Change = if (std.mem.eql(u8, filename, "GONE.TXT"))
+            .removed
+        else if (std.mem.eql(u8, filename, "EDIT.TXT"))
+            .modified
+        else if (std.mem.eql(u8, filename, "NEW.TXT"))
+            .added
+        else
+            return error.TestUnexpectedResult;
+        try std.testing.expectEqual(expected, file.change);
+    }
+    try std.testing.expect(diff.directory_sectors > 0);
+    try std.testing.expectEqual(0, diff.system_sectors);
+
+    try std.testing.expect(ImageDiff.bytesEqual("0123456789abcdefghijklmnopqrstuvwxyz", "0123456789abcdefghijklmnopqrstuvwxyz"));
+    try std.testing.expect(!ImageDiff.bytesEqual("0123456789abcdefghijklmnopqrstuvwxyz", "0123456789abcdefghijklmnopqrstuvwxy_"));
+}
+
+test "file hash" {
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    defer disk_image.deinit();
+
+    var contents: [5000]u8 = undefined;
+    for (&contents, 0..) |*byte, i| byte.* = @truncate(i);
+    for ([_][]const u8{ "ONE.BIN", "TWO.BIN" }) |filename| {
+        var contents_stream: std.Io.Reader = .fixed(&contents);
+        try disk_image.copyToImage(&contents_stream, filename, 0, false, .Binary);
+    }
+    contents[0] = 0xff;
+    var contents_stream: std.Io.Reader = .fixed(&contents);
+    try disk_image.copyToImage(&contents_stream, "VARIANT.BIN", 0, false, .Binary);
+
+    const one = try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename("ONE.BIN", 0).?);
+    const two = try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename("TWO.BIN", 0).?);
+    const variant = try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename("VARIANT.BIN", 0).?);
+    try std.testing.expectEqual(one, two);
+    try std.testing.expect(one.hash != variant.hash);
+
+    // CP/M files are hashed as stored, padded to a whole record.
+    var stored: [contents.len + 128]u8 = undefined;
+    var stored_writer: std.Io.Writer = .fixed(&stored);
+    try disk_image.copyFromImage(disk_image.directory.findByFilename("ONE.BIN", 0).?, &stored_writer, .Binary);
+    try std.testing.expectEqual(stored_writer.end, one.size);
+    try std.testing.expectEqual(FileHash.Hasher.hash(0, stored_writer.buffered()), one.hash);
+}
+
+test "hash contents as stored" {
+    var contents: [5000]u8 = undefined;
+    for (&contents, 0..) |*byte, i| byte.* = @truncate(i * 3);
+
+    for ([_]*const DiskImageType{ FDD_8IN, HD_BASIC }) |image_type| {
+        const image_file = try allocator.alloc(u8, image_type.image_size);
+        defer allocator.free(image_file);
+        var test_image: InMemoryImage = undefined;
+        test_image.init(image_file);
+        var disk_image = try newFormattedMemoryDiskImage(&test_image, image_type);
+        defer disk_image.deinit();
+
+        var contents_stream: std.Io.Reader = .fixed(&contents);
+        try disk_image.copyToImage(&contents_stream, "SYNC.BIN", 0, false, .Auto);
+        const entry = disk_image.directory.findByFilename("SYNC.BIN", 0).?;
+        const expected = FileHash.hashContents(&disk_image, &contents);
+        try std.testing.expectEqual(entry.size_in_bytes, expected.size);
+        try std.testing.expectEqual(try FileHash.hashFile(&disk_image, entry), expected);
+
+        contents[0] +%= 1;
+        try std.testing.expect(FileHash.hashContents(&disk_image, &contents).hash != expected.hash);
+        contents[0] -%= 1;
+    }
+}
+
+test "defragment" {
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    defer disk_image.deinit();
+
+    var contents: [3 * 2048]u8 = undefined;
+    for (&contents, 0..) |*byte, i| byte.* = @truncate(i);
+    var name_buf: [16]u8 = undefined;
+    for (0..8) |i| {
+        var contents_stream: std.Io.Reader = .fixed(contents[0..FDD_8IN.block_size]);
+        try disk_image.copyToImage(&contents_stream, try std.fmt.bufPrint(&name_buf, "F{d}", .{i}), 0, false, .Binary);
+    }
+    for ([_]u8{ 1, 3, 5 }) |i| {
+        try disk_image.erase(disk_image.directory.findByFilename(try std.fmt.bufPrint(&name_buf, "F{d}", .{i}), 0).?);
+    }
+    // Fills the holes left by F1, F3 and F5.
+    var contents_stream: std.Io.Reader = .fixed(&contents);
+    try disk_image.copyToImage(&contents_stream, "SPREAD", 0, false, .Binary);
+    try std.testing.expectEqual(1, disk_image.directory.fragmentation().fragmented_files);
+
+    const filenames = [_][]const u8{ "F0", "F2", "F4", "F6", "F7", "SPREAD" };
+    var before: [filenames.len]FileHash.Digest = undefined;
+    for (&before, filenames) |*digest, filename| {
+        digest.* = try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename(filename, 0).?);
+    }
+
+    const stats = try Defragment.defragment(allocator, &disk_image);
+    try std.testing.expectEqual(filenames.len, stats.files);
+    try std.testing.expect(stats.moved_allocations > 0);
+
+    // Check both the directory in memory and the one written to the image.
+    for (0..2) |_| {
+        const fragmentation = disk_image.directory.fragmentation();
+        try std.testing.expectEqual(0, fragmentation.fragmented_files);
+        try std.testing.expectEqual(1, fragmentation.free_runs);
+        for (before, filenames) |digest, filename| {
+            try std.testing.expectEqual(digest, try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename(filename, 0).?));
+        }
+        try disk_image.reuse(.{ .in_memory = &test_image.reader }, .{ .in_memory = &test_image.writer }, FDD_8IN);
+        try disk_image.loadDirectories(.full);
+    }
+}
+
+test "defragment large file" {
+    var large_buf: [1024 * 66]u8 = undefined;
+    for (&large_buf, 0..) |*byte, i| byte.* = @truncate(i * 7);
+
+    const image_buf = try allocator.alloc(u8, HD_BASIC.image_size);
+    defer allocator.free(image_buf);
+    var image_file: InMemoryImage = undefined;
+    image_file.init(image_buf);
+    var disk_image = try newFormattedMemoryDiskImage(&image_file, HD_BASIC);
+    defer disk_image.deinit();
+
+    var contents_stream: std.Io.Reader = .fixed(large_buf[0..4096]);
+    try disk_image.copyToImage(&contents_stream, "SMALL", null, false, .Auto);
+    contents_stream = .fixed(&large_buf);
+    try disk_image.copyToImage(&contents_stream, "LARGE", null, false, .Auto);
+    try disk_image.erase(disk_image.directory.findByFilename("SMALL", null).?);
+    const before = try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename("LARGE", null).?);
+
+    const stats = try Defragment.defragment(allocator, &disk_image);
+    try std.testing.expectEqual(1, stats.files);
+    try std.testing.expect(stats.moved_allocations > 0);
+
+    try disk_image.reuse(.{ .in_memory = &image_file.reader }, .{ .in_memory = &image_file.writer }, HD_BASIC);
+    try disk_image.loadDirectories(.full);
+    try std.testing.expectEqual(1, disk_image.directory.fragmentation().free_runs);
+    try std.testing.expectEqual(before, try FileHash.hashFile(&disk_image, disk_image.directory.findByFilename("LARGE", null).?));
+}
+
+test "image server" {
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const paths = [_][]const u8{ "A.DSK", "B.DSK", "C.DSK" };
+    for (paths) |path| try createServerImage(tmp.dir, path);
+
+    // Two slots for three images, so the least recently used image is closed.
+    var pool: ImageServer.Pool = try .init(io, allocator, tmp.dir, 2);
+    defer pool.deinit();
+    var client: ServerClient = try .init(&pool);
+    defer client.deinit();
+
+    const contents: [300]u8 = @splat('X');
+    _ = try client.send(.put, "A.DSK", "TEST.TXT", &contents);
+    const listing = try client.send(.list, "A.DSK", "", "");
+    try std.testing.expectEqual(@sizeOf(ImageServer.ListEntry) + "TEST.TXT".len, listing.len);
+    try std.testing.expectEqualStrings("TEST.TXT", listing[@sizeOf(ImageServer.ListEntry)..]);
+    // CP/M pads the last record.
+    const got = try client.send(.get, "A.DSK", "TEST.TXT", "");
+    try std.testing.expectEqual(384, got.len);
+    try std.testing.expectEqualSlices(u8, &contents, got[0..contents.len]);
+
+    _ = try client.send(.list, "B.DSK", "", "");
+    _ = try client.send(.list, "C.DSK", "", "");
+    for (pool.slots) |slot| try std.testing.expect(!std.mem.eql(u8, slot.path.?, "A.DSK"));
+    // Reopened with the file written before it was closed.
+    try std.testing.expectEqual(384, (try client.send(.get, "A.DSK", "TEST.TXT", "")).len);
+
+    // Deleting the file with a raw sector write is seen by the next directory request.
+    const sector = try client.send(.read_sector, "A.DSK", "", "");
+    try std.testing.expectEqual(FDD_8IN.sectorSizeRawForTrack(2), sector.len);
+    var raw: [137]u8 = undefined;
+    @memcpy(&raw, sector);
+    const name_offset = std.mem.indexOf(u8, &raw, "TEST    TXT") orelse return error.TestUnexpectedResult;
+    raw[name_offset - 1] = 0xe5;
+    _ = try client.send(.write_sector, "A.DSK", "", &raw);
+    try std.testing.expectEqual(0, (try client.send(.list, "A.DSK", "", "")).len);
+    try std.testing.expectError(error.FileNotFound, client.send(.get, "A.DSK", "TEST.TXT", ""));
+
+    try std.testing.expectError(error.InvalidPath, client.send(.list, "../A.DSK", "", ""));
+    try std.testing.expectError(error.InvalidPath, client.send(.list, "/tmp/A.DSK", "", ""));
+    _ = try client.send(.close, "A.DSK", "", "");
+}
+
+test "image server concurrent requests" {
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    try createServerImage(tmp.dir, "A.DSK");
+
+    var pool: ImageServer.Pool = try .init(io, allocator, tmp.dir, 2);
+    defer pool.deinit();
+    var setup: ServerClient = try .init(&pool);
+    defer setup.deinit();
+    const contents: [5000]u8 = @splat('R');
+    _ = try setup.send(.put, "A.DSK", "READ.BIN", &contents);
+
+    // Readers share the image while a writer puts and erases other files.
+    const Client = struct {
+        fn run(client: *ServerClient, writer: bool, result: *anyerror!void) void {
+            result.* = requests(client, writer);
+        }
+        fn requests(client: *ServerClient, writer: bool) !void {
+            var name: [16]u8 = undefined;
+            for (0..20) |i| {
+                if (writer) {
+                    const filename = try std.fmt.bufPrint(&name, "W{d}.BIN", .{i});
+                    _ = try client.send(.put, "A.DSK", filename, "written");
+                    _ = try client.send(.erase, "A.DSK", filename, "");
+                } else {
+                    const got = try client.send(.get, "A.DSK", "READ.BIN", "");
+                    if (!std.mem.allEqual(u8, got[0..5000], 'R')) return error.TestUnexpectedResult;
+                }
+            }
+        }
+    };
+    var clients: [4]ServerClient = undefined;
+    for (&clients) |*client| client.* = try .init(&pool);
+    defer for (&clients) |*client| client.deinit();
+    var results: [clients.len]anyerror!void = undefined;
+    var threads: [clients.len]std.Thread = undefined;
+    for (&threads, &clients, &results, 0..) |*thread, *client, *result, i| {
+        thread.* = try std.Thread.spawn(.{}, Client.run, .{ client, i == 0, result });
+    }
+    for (threads) |thread| thread.join();
+    for (results) |result| try result;
+    try std.testing.expectEqual(@sizeOf(ImageServer.ListEntry) + "READ.BIN".len, (try setup.send(.list, "A.DSK", "", "")).len);
+}
+
+/// Write a formatted FDD_8IN image to `dir`.
+fn createServerImage(dir: std.Io.Dir, path: []const u8) !void {
+    const image_file = try allocator.alloc(u8, FDD_8IN.image_size);
+    defer allocator.free(image_file);
+    var test_image: InMemoryImage = undefined;
+    test_image.init(image_file);
+    var disk_image = try newFormattedMemoryDiskImage(&test_image, FDD_8IN);
+    disk_image.deinit();
+
+    var file = try dir.createFile(io, path, .{});
+    defer file.close(io);
+    var file_writer = file.writer(io, &.{});
+    try file_writer.interface.writeAll(image_file);
+}
+
+/// Sends requests straight to an image server Connection, without a socket.
+const ServerClient = struct {
+    connection: ImageServer.Connection,
+    request_buffer: []u8,
+    response_buffer: []u8,
+
+    /// Errors the server is expected to return in these tests.
+    const ServerError = error{ FileNotFound, InvalidPath, PathAlreadyExists, ImageBusy, PoolBusy, InvalidSectorSize };
+
+    fn init(pool: *ImageServer.Pool) !ServerClient {
+        const request_buffer = try allocator.alloc(u8, 16 * 1024);
+        errdefer allocator.free(request_buffer);
+        return .{
+            .connection = .init(pool),
+            .request_buffer = request_buffer,
+            .response_buffer = try allocator.alloc(u8, 16 * 1024),
+        };
+    }
+
+    fn deinit(self: *ServerClient) void {
+        self.connection.deinit();
+        allocator.free(self.response_buffer);
+        allocator.free(self.request_buffer);
+    }
+
+    /// Send a request and return the response payload, or the server's error.
+    /// Sector requests are for track 2, sector 0.
+    fn send(self: *ServerClient, op: ImageServer.Op, path: []const u8, name: []const u8, data: []const u8) (ServerError || error{ RequestFailed, ReadFailed, WriteFailed, EndOfStream })![]const u8 {
+        var request: std.Io.Writer = .fixed(self.request_buffer);
+        try request.writeStruct(ImageServer.Request{
+            .op = op,
+            .user = 0,
+            .path_len = @intCast(path.len),
+            .name_len = @intCast(name.len),
+            .track = 2,
+            .sector = 0,
+            .data_len = @intCast(data.len),
+        }, .little);
+        try request.writeAll(path);
+        try request.writeAll(name);
+        try request.writeAll(data);
+        var reader: std.Io.Reader = .fixed(request.buffered());
+        var writer: std.Io.Writer = .fixed(self.response_buffer);
+        try self.connection.serveRequest(&reader, &writer);
+
+        var response_reader: std.Io.Reader = .fixed(writer.buffered());
+        const response = try response_reader.takeStruct(ImageServer.Response, .little);
+        const payload = try response_reader.take(response.len);
+        if (response.status == .ok) return payload;
+        inline for (@typeInfo(ServerError).error_set.?) |server_error| {
+            if (std.mem.eql(u8, payload, server_error.name)) return @field(ServerError, server_error.name);
+        }
+        return error.RequestFailed;
+    }
+};
+
+test "sector device" {
+    var file_reader: std.Io.File.Reader = undefined;
+    var file_writer: std.Io.File.Writer = undefined;
+    var disk_image = try newPhysicalDiskImage(&file_reader, &file_writer, FDD_8IN);
+    defer disk_image.deinit();
+    defer file_reader.file.close(io);
+
+    inline for (.{ true, false }) |skew| {
+        var device: SectorDevice = undefined;
+        try device.init(io, allocator, file_reader.file, FDD_8IN, .{ .cached_tracks = 2, .skew = skew });
+        defer device.deinit();
+
+        // Three tracks through a two track cache, so a dirty track is evicted.
+        var raw: [137]u8 = undefined;
+        for (2..5) |track| {
+            @memset(&raw, @intCast(track));
+            try device.writeSector(.{ .track = @intCast(track), .sector = 5 }, &raw);
+        }
+        try std.testing.expectError(error.InvalidSectorSize, device.writeSector(.{ .track = 2, .sector = 5 }, raw[0..128]));
+        try device.flush();
+        try std.testing.expect(device.stats.evictions + device.stats.writebacks >= 3);
+
+        for (2..5) |track| {
+            const location: PhysicalAddress = .{ .track = @intCast(track), .sector = 5 };
+            try device.readSector(location, &raw);
+            try std.testing.expect(std.mem.allEqual(u8, &raw, @intCast(track)));
+            // Written to the same place DiskImage reads from, or straight to the sector's place in the track.
+            if (skew) {
+                var sector: DiskSector = undefined;
+                try disk_image.readSector(location, &sector);
+                try std.testing.expectEqualSlices(u8, &raw, sector.rawBytes());
+            } else {
+                var on_disk: [137]u8 = undefined;
+                try disk_image.reader.readAt(FDD_8IN.seekOffset(location), &on_disk);
+                try std.testing.expectEqualSlices(u8, &raw, &on_disk);
+            }
+        }
+    }
+}
+
 test "erase large file" {
     var large_buf: [1024 * 66]u8 = @splat(0x55);
     var large_reader: std.Io.Reader = .fixed(&large_buf);
@@ -1013,13 +1817,24 @@ fn saveFile(contents: []const u8) void {
 
 const std = @import("std");
 const DiskImage = @import("disk_image.zig").DiskImage;
+const MappedImage = @import("disk_image.zig").MappedImage;
+const LoadedImage = @import("disk_image.zig").LoadedImage;
+const SectorCache = @import("sector_cache.zig");
 const DiskImageType = @import("disk_types.zig").DiskImageType;
 const DiskImageTypes = @import("disk_types.zig").DiskImageTypes;
+const DiskSector = @import("disk_types.zig").DiskSector;
+const PhysicalAddress = @import("disk_types.zig").PhysicalAddress;
 const DiskLabel = @import("disk_types.zig").DiskLabel;
 const FileNameIterator = @import("directory_table.zig").FileNameIterator;
 const OperatingSystem = @import("disk_types.zig").OperatingSystem;
 const DirectoryTable = @import("directory_table.zig").DirectoryTable;
 const all_disk_types = @import("disk_types.zig").all_disk_types;
+const TarWriter = @import("tar.zig");
+const ImageDiff = @import("image_diff.zig");
+const FileHash = @import("file_hash.zig");
+const Defragment = @import("defragment.zig");
+const ImageServer = @import("image_server.zig");
+const SectorDevice = @import("sector_device.zig");
 const FDD_8IN = all_disk_types.getPtrConst(.FDD_8IN);
 const HDD_5MB = all_disk_types.getPtrConst(.HDD_5MB);
 const HDD_5MB_1024 = all_disk_types.getPtrConst(.HDD_5MB_1024);
@@ -307,11 +307,8 @@ pub const DiskSector = union(enum) {
 
     /// Calculate the checksum for MITS hard-sectored 8" disks
     fn mitsChecksum(self: *DiskSector, _: PhysicalAddress) u8 {
-        var csum: u8 = 0;
+        var csum: u8 = sumBytes(self.dataBytes()[0..128]);
 
-        for (self.dataBytes()) |b| {
-            csum +%= b;
-        }
         if (self.* == .data) {
             csum +%= self.rawBytes()[2];
             csum +%= self.rawBytes()[3];
@@ -322,38 +319,62 @@ pub const DiskSector = union(enum) {
     }
 
     fn mitsChecksumMini(self: *DiskSector, _: PhysicalAddress) u8 {
-        var csum: u8 = 0;
+        return sumBytes(self.dataBytes()[0..128]);
+    }
 
-        for (self.dataBytes()) |b| {
+    const sum_lanes = 16;
+
+    /// Wrapping sum of a 128 byte data block, summed `sum_lanes` bytes at a time.
+    pub fn sumBytes(bytes: *const [128]u8) u8 {
+        var acc: @Vector(sum_lanes, u8) = @splat(0);
+        inline for (0..bytes.len / sum_lanes) |i| {
+            const lanes: @Vector(sum_lanes, u8) = bytes[i * sum_lanes ..][0..sum_lanes].*;
+            acc +%= lanes;
+        }
+        return @reduce(.Add, acc);
+    }
+
+    /// Byte at a time version of sumBytes(). Used for testing and benchmarking.
+    pub fn sumBytesScalar(bytes: *const [128]u8) u8 {
+        var csum: u8 = 0;
+        for (bytes) |b| {
             csum +%= b;
         }
         return csum;
     }
 
+    /// Return the checksum prepareWrite() would store in this sector, or null if the sector has no checksum.
+    pub fn expectedChecksum(self: *DiskSector, image_type: *const DiskImageType, location: PhysicalAddress) ?u8 {
+        return switch (self.*) {
+            .reserved => switch (image_type.OS) {
+                .cpm, .ados => self.mitsChecksum(location),
+                else => unreachable,
+            },
+            .data => if (image_type.type_id == .ADOS_MINI and location.track == 0 and location.sector == 0)
+                0x15
+            else if (image_type.type_id == .CPM_MINI)
+                self.mitsChecksumMini(location)
+            else
+                self.mitsChecksum(location),
+            else => null,
+        };
+    }
+
+    /// Returns false if the sector has a checksum and it doesn't match the sector contents.
+    pub fn verifyChecksum(self: *DiskSector, image_type: *const DiskImageType, location: PhysicalAddress) bool {
+        const expected = self.expectedChecksum(image_type, location) orelse return true;
+        return switch (self.*) {
+            inline .reserved, .data => |sector| sector.checksum == expected,
+            else => true,
+        };
+    }
+
     /// Called just before the sector is written to disk.
     pub fn prepareWrite(self: *DiskSector, image_type: *const DiskImageType, location: PhysicalAddress) void {
+        const checksum = self.expectedChecksum(image_type, location) orelse return;
         switch (self.*) {
-            .reserved => |*sector| {
-                switch (image_type.OS) {
-                    .cpm => {
-                        sector.checksum = self.mitsChecksum(location);
-                    },
-                    .ados => {
-                        sector.checksum = self.mitsChecksum(location);
-                    },
-                    else => unreachable,
-                }
-            },
-            .data => |*sector| {
-                if (image_type.type_id == .ADOS_MINI and location.track == 0 and location.sector == 0) {
-                    sector.checksum = 0x15;
-                } else if (image_type.type_id == .CPM_MINI) {
-                    sector.checksum = self.mitsChecksumMini(location);
-                } else {
-                    sector.checksum = self.mitsChecksum(location);
-                }
-            },
-            else => {},
+            inline .reserved, .data => |*sector| sector.checksum = checksum,
+            else => unreachable,
         }
     }
 
@@ -385,11 +406,12 @@ pub const DiskSector = union(enum) {
         };
     }
 
-    /// Hexdump raw sector information.
-    pub fn dump(self: DiskSector, location: PhysicalAddress, offset: usize) !void {
+    /// Hexdump raw sector information, with the skewed sector of the logical `location` as stored on disk.
+    pub fn dump(self: DiskSector, image_type: *const DiskImageType, location: PhysicalAddress, offset: usize) !void {
         if (!DUMP)
             return;
-        std.debug.print("Disk Sector: TRACK: {} - SECTOR {} - OFFSET: {}\n", .{ location.track, location.sector, offset });
+        const physical_sector = image_type.skew(location.track, location.sector);
+        std.debug.print("Disk Sector: TRACK: {} - SECTOR {} - OFFSET: {}\n", .{ location.track, physical_sector, offset });
         std.debug.dumpHex(std.mem.asBytes(self));
     }
 };
@@ -462,6 +484,9 @@ pub const DiskImageType = struct {
     dirs_per_sector: u16 = undefined,
     dir_entry_size: u8 = undefined,
     sectors_per_alloc: u16 = undefined,
+    // File offset of every logical sector, indexed by track * sector_stride + sector. See sectorOffset()
+    sector_offsets: []const u32 = undefined,
+    sector_stride: u16 = undefined,
 
     pub fn init(self: *DiskImageType) void {
         comptime std.debug.assert(self.skew_table.len == self.sectors_per_track);
@@ -478,6 +503,22 @@ pub const DiskImageType = struct {
         self.dirs_per_alloc = self.block_size / self.dir_entry_size;
         self.dirs_per_sector = self.sector_size_data / self.dir_entry_size;
         self.sectors_per_alloc = self.block_size / self.sector_size_data;
+
+        // Pre-calculate the skewed offset of every sector, so that translating an address at runtime
+        // is a single table lookup. init() is only ever called at comptime.
+        @setEvalBranchQuota(4_000_000);
+        self.sector_stride = @max(self.sectors_per_track, self.sectors_per_track0 orelse 0);
+        var sector_offsets: [@as(usize, self.tracks) * self.sector_stride]u32 = @splat(std.math.maxInt(u32));
+        for (0..self.tracks) |track_nr| {
+            const track: u16 = @intCast(track_nr);
+            for (0..self.sectorsForTrack(track)) |sector_nr| {
+                const physical_sector = self.skew(track, @intCast(sector_nr));
+                std.debug.assert(physical_sector < self.sectorsForTrack(track));
+                sector_offsets[track_nr * self.sector_stride + sector_nr] = @intCast(self.seekOffset(.{ .track = track, .sector = physical_sector }));
+            }
+        }
+        const final_offsets = sector_offsets;
+        self.sector_offsets = &final_offsets;
     }
 
     pub fn dump(self: *const DiskImageType) void {
@@ -531,6 +572,12 @@ pub const DiskImageType = struct {
         }
     }
 
+    /// Convert a logical track / sector into a seek offset, including any skew.
+    /// The location must be valid. See PhysicalAddress.validate()
+    pub fn sectorOffset(self: *const DiskImageType, location: PhysicalAddress) usize {
+        return self.sector_offsets[@as(usize, location.track) * self.sector_stride + location.sector];
+    }
+
     /// How large is the data portion of the sector for this track?
     pub fn sectorSizeDataForTrack(self: *const DiskImageType, track_nr: u16) u16 {
         return if (track_nr > 0) self.sector_size_data else self.sector_size_data0 orelse self.sector_size_data;
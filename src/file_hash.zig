@@ -0,0 +1,82 @@
+//! Hash the contents of files on an image, without copying them anywhere.
+//! Files are read with the same per-OS readers as copyFromImage(), and the contents
+//! are fed straight into the hash as each sector is read.
+//! Host files can be hashed as they would be stored, to find files that need copying.
+
+pub const Hasher = std.hash.XxHash3;
+
+pub const HashError = DiskImage.CopyFromImageError;
+
+pub const Digest = struct {
+    hash: u64,
+    size: u64,
+};
+
+/// Hash the contents of `entry` exactly as they are stored on the image. See DiskImage.exactTextMode()
+/// Can be called for several files at once from different threads, as long as the image has no sector cache.
+pub fn hashFile(image: *DiskImage, entry: *const CookedDirEntry) HashError!Digest {
+    var buffer: [4096]u8 = undefined;
+    var hash_writer: HashWriter = .init(&buffer);
+    try image.copyFromImage(entry, &hash_writer.interface, image.exactTextMode());
+    return hash_writer.final();
+}
+
+/// Hash `contents` as copyToImage() stores them in a text mode that doesn't convert them,
+/// so a host file can be compared with the result of hashFile()
+pub fn hashContents(image: *const DiskImage, contents: []const u8) Digest {
+    var hash_writer: HashWriter = .init(&.{});
+    hash_writer.update(contents);
+    switch (image.image_type.OS) {
+        // CP/M and CDOS store whole records, with the last record padded with ^Z
+        .cpm, .cdos => {
+            const padding: [127]u8 = @splat(0x1a);
+            hash_writer.update(padding[0 .. (128 - contents.len % 128) % 128]);
+        },
+        .ados, .hd_basic => {},
+    }
+    return hash_writer.final();
+}
+
+/// A Writer that hashes and counts everything written to it.
+const HashWriter = struct {
+    hasher: Hasher,
+    size: u64,
+    interface: std.Io.Writer,
+
+    fn init(buffer: []u8) HashWriter {
+        return .{
+            .hasher = .init(0),
+            .size = 0,
+            .interface = .{ .vtable = &.{ .drain = drain }, .buffer = buffer },
+        };
+    }
+
+    fn update(self: *HashWriter, bytes: []const u8) void {
+        self.hasher.update(bytes);
+        self.size += bytes.len;
+    }
+
+    fn drain(w: *std.Io.Writer, data: []const []const u8, splat: usize) std.Io.Writer.Error!usize {
+        const self: *HashWriter = @alignCast(@fieldParentPtr("interface", w));
+        self.update(w.buffered());
+        w.end = 0;
+        var consumed: usize = 0;
+        for (data[0 .. data.len - 1]) |bytes| {
+            self.update(bytes);
+            consumed += bytes.len;
+        }
+        const pattern = data[data.len - 1];
+        for (0..splat) |_| self.update(pattern);
+        return consumed + pattern.len * splat;
+    }
+
+    fn final(self: *HashWriter) Digest {
+        self.update(self.interface.buffered());
+        self.interface.end = 0;
+        return .{ .hash = self.hasher.final(), .size = self.size };
+    }
+};
+
+const std = @import("std");
+const DiskImage = @import("disk_image.zig").DiskImage;
+const CookedDirEntry = @import("directory_table.zig").CookedDirEntry;
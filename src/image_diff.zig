@@ -0,0 +1,227 @@
+//! Compare two images of the same type and work out which files changed between them.
+//! The raw images are compared a track at a time and then a sector at a time within any track that differs.
+//! Every differing sector is mapped through the allocations in each image's directory to the file
+//! that owns it in either image, so only the directories need to be loaded, not the files themselves.
+
+/// Number of bytes compared at once by bytesEqual()
+const compare_lanes = std.simd.suggestVectorLength(u8) orelse 16;
+
+pub const Change = enum { added, removed, modified };
+
+pub const FileChange = struct {
+    change: Change,
+    /// Entry from the new image, or from the old image for removed files.
+    entry: *const CookedDirEntry,
+    /// Number of differing sectors that belong to the file in either image.
+    sectors: u32,
+};
+
+pub const Diff = struct {
+    files: std.ArrayList(FileChange) = .empty,
+    /// Number of differing sectors in total, then by where they are on the image.
+    sectors: u32 = 0,
+    system_sectors: u32 = 0,
+    directory_sectors: u32 = 0,
+    /// Sectors not allocated to a file in either image.
+    free_sectors: u32 = 0,
+
+    pub fn deinit(self: *Diff, gpa: std.mem.Allocator) void {
+        self.files.deinit(gpa);
+    }
+};
+
+pub const CompareError = error{ DifferentImageTypes, OutOfMemory } || DiskImage.ReadSectorError;
+
+/// Compare `old` with `new`. Both images must be the same type and have their directories fully loaded.
+/// The returned Diff refers to the directory entries of both images, so must be freed before either image.
+pub fn compare(gpa: std.mem.Allocator, old: *DiskImage, new: *DiskImage) CompareError!Diff {
+    if (old.image_type != new.image_type) return error.DifferentImageTypes;
+    const image_type = old.image_type;
+
+    var old_image: ImageBytes = try .init(gpa, old);
+    defer old_image.deinit(gpa);
+    var new_image: ImageBytes = try .init(gpa, new);
+    defer new_image.deinit(gpa);
+
+    var old_files: FileSectors = try .init(gpa, old);
+    defer old_files.deinit(gpa);
+    var new_files: FileSectors = try .init(gpa, new);
+    defer new_files.deinit(gpa);
+
+    var diff: Diff = .{};
+    errdefer diff.deinit(gpa);
+
+    for (0..image_type.tracks) |track_nr| {
+        const track: u16 = @intCast(track_nr);
+        const sector_size = image_type.sectorSizeRawForTrack(track);
+        const track_start = image_type.seekOffset(.{ .track = track, .sector = 0 });
+        const track_len = @as(usize, image_type.sectorsForTrack(track)) * sector_size;
+        if (bytesEqual(old_image.bytes[track_start..][0..track_len], new_image.bytes[track_start..][0..track_len])) continue;
+
+        for (0..image_type.sectorsForTrack(track)) |sector_nr| {
+            const location: PhysicalAddress = .{ .track = track, .sector = @intCast(sector_nr) };
+            const offset = image_type.sectorOffset(location);
+            if (bytesEqual(old_image.bytes[offset..][0..sector_size], new_image.bytes[offset..][0..sector_size])) continue;
+
+            diff.sectors += 1;
+            switch (sectorRegion(image_type, location)) {
+                .system => diff.system_sectors += 1,
+                .directory => diff.directory_sectors += 1,
+                .allocation => |allocation| {
+                    const in_old = old_files.sectorChanged(allocation);
+                    const in_new = new_files.sectorChanged(allocation);
+                    if (!in_old and !in_new) diff.free_sectors += 1;
+                },
+            }
+        }
+    }
+
+    // Files are matched between the images by user and filename.
+    const old_entries = old.directory.cooked_directories.items;
+    const new_entries = new.directory.cooked_directories.items;
+    for (new_entries, new_files.changed_sectors) |*new_entry, new_sectors| {
+        const old_entry = old.directory.findByFilename(new_entry.filenameAndExtension(), new_entry.user) orelse {
+            try diff.files.append(gpa, .{ .change = .added, .entry = new_entry, .sectors = new_sectors });
+            continue;
+        };
+        const old_sectors = old_files.changed_sectors[entryIndex(old_entries, old_entry)];
+        const sectors = old_sectors + new_sectors;
+        if (sectors > 0 or !sameLayout(old_entry, new_entry)) {
+            try diff.files.append(gpa, .{ .change = .modified, .entry = new_entry, .sectors = sectors });
+        }
+    }
+    for (old_entries, old_files.changed_sectors) |*old_entry, old_sectors| {
+        if (new.directory.findByFilename(old_entry.filenameAndExtension(), old_entry.user) == null) {
+            try diff.files.append(gpa, .{ .change = .removed, .entry = old_entry, .sectors = old_sectors });
+        }
+    }
+    return diff;
+}
+
+/// Compare two equal length byte slices a vector at a time.
+pub fn bytesEqual(a: []const u8, b: []const u8) bool {
+    std.debug.assert(a.len == b.len);
+    var i: usize = 0;
+    while (i + compare_lanes <= a.len) : (i += compare_lanes) {
+        const a_lanes: @Vector(compare_lanes, u8) = a[i..][0..compare_lanes].*;
+        const b_lanes: @Vector(compare_lanes, u8) = b[i..][0..compare_lanes].*;
+        if (@reduce(.Or, a_lanes != b_lanes)) return false;
+    }
+    return std.mem.eql(u8, a[i..], b[i..]);
+}
+
+/// The contents of a whole image. Mapped and in memory images are used as they are,
+/// otherwise the image is read into memory.
+const ImageBytes = struct {
+    bytes: []const u8,
+    read_buffer: ?[]u8,
+
+    fn init(gpa: std.mem.Allocator, image: *DiskImage) (error{OutOfMemory} || SeekableReader.ReadAtError)!ImageBytes {
+        const size = image.image_type.image_size;
+        if (image.reader.memory()) |memory| {
+            if (memory.len < size) return error.EndOfStream;
+            return .{ .bytes = memory[0..size], .read_buffer = null };
+        }
+        const read_buffer = try gpa.alloc(u8, size);
+        errdefer gpa.free(read_buffer);
+        try image.reader.readAt(0, read_buffer);
+        return .{ .bytes = read_buffer, .read_buffer = read_buffer };
+    }
+
+    fn deinit(self: *ImageBytes, gpa: std.mem.Allocator) void {
+        if (self.read_buffer) |read_buffer| gpa.free(read_buffer);
+    }
+};
+
+/// Which file owns each allocation of an image, and how many of each file's sectors differ.
+const FileSectors = struct {
+    /// Index into cooked_directories of the owner of each allocation.
+    owners: []u16,
+    /// Indexed the same as cooked_directories.
+    changed_sectors: []u32,
+
+    const no_owner = std.math.maxInt(u16);
+
+    fn init(gpa: std.mem.Allocator, image: *DiskImage) (error{OutOfMemory} || DiskImage.ReadSectorError)!FileSectors {
+        const entries = image.directory.cooked_directories.items;
+        const owners = try gpa.alloc(u16, image.image_type.total_allocs);
+        errdefer gpa.free(owners);
+        @memset(owners, no_owner);
+        const changed_sectors = try gpa.alloc(u32, entries.len);
+        errdefer gpa.free(changed_sectors);
+        @memset(changed_sectors, 0);
+
+        for (entries, 0..) |*entry, i| {
+            for (entry.allocations.items) |allocation| {
+                if (allocation < owners.len) owners[allocation] = @intCast(i);
+            }
+            // The allocations of large HD BASIC files only hold the lists of data allocations.
+            if (entry.os == .hd_basic and entry.fileType() == .large) {
+                var buffer: [256]u8 = undefined;
+                var file_reader: os_hd_basic.ImageFileReader = .init(image, entry, &buffer);
+                while (try file_reader.nextAllocation()) |allocation| {
+                    if (allocation < owners.len) owners[allocation] = @intCast(i);
+                }
+            }
+        }
+        return .{ .owners = owners, .changed_sectors = changed_sectors };
+    }
+
+    fn deinit(self: *FileSectors, gpa: std.mem.Allocator) void {
+        gpa.free(self.changed_sectors);
+        gpa.free(self.owners);
+    }
+
+    /// Count a differing sector against the file that owns `allocation`.
+    /// Returns false if no file owns it.
+    fn sectorChanged(self: *FileSectors, allocation: u16) bool {
+        if (allocation >= self.owners.len or self.owners[allocation] == no_owner) return false;
+        self.changed_sectors[self.owners[allocation]] += 1;
+        return true;
+    }
+};
+
+const Region = union(enum) {
+    /// Boot and system tracks, and the HD BASIC volume label and allocation map.
+    system,
+    directory,
+    allocation: u16,
+};
+
+/// Where a sector is on the image. The inverse of each OS's allocation to track and sector mapping.
+fn sectorRegion(image_type: *const DiskImageType, location: PhysicalAddress) Region {
+    switch (image_type.OS) {
+        .ados => |ados| if (location.track == ados.directory_track) return .directory,
+        else => {},
+    }
+    if (location.track < image_type.reserved_tracks) return .system;
+
+    // HD BASIC numbers allocations from the start of the disk, the others from the first data track.
+    const first_track = if (image_type.OS == .hd_basic) 0 else image_type.reserved_tracks;
+    const sector = @as(u32, location.track - first_track) * image_type.sectors_per_track + location.sector;
+    const allocation: u16 = @intCast(sector / image_type.sectors_per_alloc);
+    return switch (image_type.OS) {
+        .cpm, .cdos, .hd_basic => if (allocation < image_type.reserved_allocs) .directory else .{ .allocation = allocation },
+        .ados => .{ .allocation = allocation },
+    };
+}
+
+/// False if the file's size or allocations changed, e.g. a file truncated without any of its data changing.
+fn sameLayout(old: *const CookedDirEntry, new: *const CookedDirEntry) bool {
+    return old.size_in_bytes == new.size_in_bytes and
+        std.mem.eql(u16, old.allocations.items, new.allocations.items);
+}
+
+fn entryIndex(entries: []const CookedDirEntry, entry: *const CookedDirEntry) usize {
+    return (@intFromPtr(entry) - @intFromPtr(entries.ptr)) / @sizeOf(CookedDirEntry);
+}
+
+const std = @import("std");
+const di = @import("disk_image.zig");
+const DiskImage = di.DiskImage;
+const SeekableReader = di.SeekableReader;
+const disk_types = @import("disk_types.zig");
+const DiskImageType = disk_types.DiskImageType;
+const PhysicalAddress = disk_types.PhysicalAddress;
+const CookedDirEntry = @import("directory_table.zig").CookedDirEntry;
+const os_hd_basic = @import("os_hd_basic.zig");
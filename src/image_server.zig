@@ -0,0 +1,496 @@
+//! Serve disk images over a Unix domain socket, so tools and emulators that access the same images
+//! over and over don't pay for starting a process, detecting the image type and loading the directory each time.
+//! Images are kept open in a pool with their directories loaded, and the least recently used image is
+//! closed when a new one is needed. Requests that only read an image run at the same time as each other.
+//!
+//! Each request is a Request header followed by the image path, the filename and any data.
+//! Each response is a Response header followed by the payload, or the error name if the request failed.
+//! All integers are little endian. A connection can send any number of requests, each answered in turn.
+//! Image paths must be relative to the server's directory, without any `..` components.
+//! A limited number of connections are served at once, further clients wait to be accepted.
+//! The server assumes it is the only process writing to the images it has open. Send `close` to
+//! release an image before changing it any other way.
+
+pub const default_pool_size = 16;
+
+/// Most connections served at once. Further clients wait in the listen backlog until a connection closes.
+pub const default_max_connections = 64;
+
+/// Largest amount of data accepted with a request. Larger than any supported image.
+pub const max_data_len = 16 * 1024 * 1024;
+
+/// The `user` of a Request that matches files of any user.
+pub const any_user = 0xff;
+
+pub const Op = enum(u8) {
+    /// Payload: a ListEntry and the filename for each file.
+    list = 1,
+    /// Payload: the contents of file `name`, exactly as stored. See DiskImage.exactTextMode()
+    get = 2,
+    /// Write the data to file `name`, replacing any existing file.
+    put = 3,
+    /// Erase file `name`.
+    erase = 4,
+    /// Payload: the whole unskewed sector at `track` and `sector`, including any header and checksum.
+    read_sector = 5,
+    /// Write the data, which must be a whole sector, to `track` and `sector`. Any checksum is recalculated.
+    write_sector = 6,
+    /// Write back and close the image, if it is open and not in use.
+    close = 7,
+    _,
+
+    fn writes(self: Op) bool {
+        return switch (self) {
+            .put, .erase, .write_sector => true,
+            else => false,
+        };
+    }
+};
+
+pub const Request = extern struct {
+    op: Op,
+    /// CP/M user, or any_user. Files are put to user 0 for any_user.
+    user: u8 = any_user,
+    path_len: u16,
+    name_len: u16 = 0,
+    track: u16 = 0,
+    sector: u16 = 0,
+    reserved: u16 = 0,
+    data_len: u32 = 0,
+};
+
+pub const Status = enum(u8) { ok = 0, failed = 1, _ };
+
+pub const Response = extern struct {
+    status: Status,
+    reserved: [3]u8 = @splat(0),
+    len: u32,
+};
+
+pub const ListEntry = extern struct {
+    user: u8,
+    name_len: u8,
+    attribs: [2]u8,
+    size: u32,
+};
+
+comptime {
+    std.debug.assert(@sizeOf(Request) == 16);
+    std.debug.assert(@sizeOf(Response) == 8);
+    std.debug.assert(@sizeOf(ListEntry) == 8);
+}
+
+/// Listen on `socket_path` and serve requests until the process is stopped.
+/// Each connection is served by its own thread, with at most `max_connections` at once.
+/// Image paths are relative to the current directory.
+pub fn run(io: std.Io, gpa: std.mem.Allocator, socket_path: []const u8, pool_size: usize, max_connections: usize) !void {
+    std.debug.assert(max_connections > 0);
+    var pool: Pool = try .init(io, gpa, std.Io.Dir.cwd(), pool_size);
+    defer pool.deinit();
+    var limit: ConnectionLimit = .{ .max = max_connections };
+
+    const address: std.Io.net.UnixAddress = try .init(socket_path);
+    var server = try address.listen(io, .{});
+    defer server.deinit(io);
+    log.info("Serving images on {s}", .{socket_path});
+
+    while (true) {
+        // Don't accept another connection until there is a thread free to serve it.
+        limit.acquire(io);
+        const stream = server.accept(io) catch |err| {
+            log.err("Unable to accept connection: {t}", .{err});
+            limit.release(io);
+            continue;
+        };
+        const thread = std.Thread.spawn(.{}, serveConnection, .{ &pool, &limit, stream }) catch |err| {
+            log.err("Unable to start connection thread: {t}", .{err});
+            stream.close(io);
+            limit.release(io);
+            continue;
+        };
+        thread.detach();
+    }
+}
+
+/// Counts the connections being served, so that no more than `max` are served at once.
+const ConnectionLimit = struct {
+    mutex: std.Io.Mutex = .init,
+    /// Signalled when a connection closes.
+    closed: std.Io.Condition = .init,
+    active: usize = 0,
+    max: usize,
+
+    /// Wait until fewer than `max` connections are being served, then count another.
+    fn acquire(self: *ConnectionLimit, io: std.Io) void {
+        self.mutex.lockUncancelable(io);
+        defer self.mutex.unlock(io);
+        while (self.active >= self.max) self.closed.waitUncancelable(io, &self.mutex);
+        self.active += 1;
+    }
+
+    fn release(self: *ConnectionLimit, io: std.Io) void {
+        self.mutex.lockUncancelable(io);
+        defer self.mutex.unlock(io);
+        self.active -= 1;
+        self.closed.signal(io);
+    }
+};
+
+fn serveConnection(pool: *Pool, limit: *ConnectionLimit, stream: std.Io.net.Stream) void {
+    const io = pool.io;
+    defer limit.release(io);
+    defer stream.close(io);
+    var read_buffer: [64 * 1024]u8 = undefined;
+    var write_buffer: [64 * 1024]u8 = undefined;
+    var stream_reader = stream.reader(io, &read_buffer);
+    var stream_writer = stream.writer(io, &write_buffer);
+
+    var connection: Connection = .init(pool);
+    defer connection.deinit();
+    while (true) {
+        connection.serveRequest(&stream_reader.interface, &stream_writer.interface) catch |err| {
+            // The client closing the connection between requests is normal.
+            if (err != error.EndOfStream) log.info("Closing connection: {t}", .{err});
+            return;
+        };
+        stream_writer.interface.flush() catch return;
+    }
+}
+
+/// The state of one client connection. Buffers are kept between requests.
+pub const Connection = struct {
+    pool: *Pool,
+    path_buffer: [std.fs.max_path_bytes]u8 = undefined,
+    name_buffer: [CookedDirEntry.filename_max]u8 = undefined,
+    /// Data sent with the request.
+    data: std.ArrayList(u8) = .empty,
+    /// Payload of the response, unless it can be sent from somewhere else.
+    payload: std.Io.Writer.Allocating,
+    sector: DiskSector = undefined,
+
+    pub fn init(pool: *Pool) Connection {
+        return .{ .pool = pool, .payload = .init(pool.gpa) };
+    }
+
+    pub fn deinit(self: *Connection) void {
+        self.payload.deinit();
+        self.data.deinit(self.pool.gpa);
+    }
+
+    /// Read one request from `reader` and write its response to `writer`.
+    /// Only fails if the connection can't continue.
+    pub fn serveRequest(self: *Connection, reader: *std.Io.Reader, writer: *std.Io.Writer) (std.Io.Reader.Error || std.Io.Writer.Error)!void {
+        const request = try reader.takeStruct(Request, .little);
+        if (request.path_len > self.path_buffer.len or request.name_len > self.name_buffer.len or request.data_len > max_data_len) {
+            try reader.discardAll(@as(usize, request.path_len) + request.name_len + request.data_len);
+            return respondError(writer, error.RequestTooLarge);
+        }
+        const path = self.path_buffer[0..request.path_len];
+        try reader.readSliceAll(path);
+        const name = self.name_buffer[0..request.name_len];
+        try reader.readSliceAll(name);
+        self.data.resize(self.pool.gpa, request.data_len) catch |err| {
+            try reader.discardAll(request.data_len);
+            return respondError(writer, err);
+        };
+        try reader.readSliceAll(self.data.items);
+
+        const payload = self.handle(request, path, name) catch |err| return respondError(writer, err);
+        try writer.writeStruct(Response{ .status = .ok, .len = @intCast(payload.len) }, .little);
+        try writer.writeAll(payload);
+    }
+
+    fn respondError(writer: *std.Io.Writer, err: anyerror) std.Io.Writer.Error!void {
+        const name = @errorName(err);
+        try writer.writeStruct(Response{ .status = .failed, .len = @intCast(name.len) }, .little);
+        try writer.writeAll(name);
+    }
+
+    /// Carry out `request` and return the response payload.
+    fn handle(self: *Connection, request: Request, path: []const u8, name: []const u8) ![]const u8 {
+        if (!isConfinedPath(path)) return error.InvalidPath;
+        switch (request.op) {
+            .close => {
+                try self.pool.close(path);
+                return &.{};
+            },
+            .list, .get, .put, .erase, .read_sector, .write_sector => {},
+            _ => return error.InvalidOperation,
+        }
+
+        var lock: Lock = if (request.op.writes()) .exclusive else .shared;
+        const slot = try self.pool.acquire(path, lock);
+        defer self.pool.release(slot, lock);
+        const disk_image = &slot.image.disk_image;
+        const user: ?u8 = if (request.user == any_user) null else request.user;
+
+        switch (request.op) {
+            .list => {
+                try slot.freshDirectory(self.pool.io, &lock);
+                self.payload.clearRetainingCapacity();
+                const writer = &self.payload.writer;
+                for (disk_image.directory.cooked_directories.items) |*entry| {
+                    if (user != null and entry.user != user.?) continue;
+                    const filename = entry.filenameAndExtension();
+                    try writer.writeStruct(ListEntry{
+                        .user = entry.user,
+                        .name_len = @intCast(filename.len),
+                        .attribs = entry.attribs,
+                        .size = entry.size_in_bytes,
+                    }, .little);
+                    try writer.writeAll(filename);
+                }
+                return self.payload.written();
+            },
+            .get => {
+                try slot.freshDirectory(self.pool.io, &lock);
+                const entry = disk_image.directory.findByFilename(name, user) orelse return error.FileNotFound;
+                self.payload.clearRetainingCapacity();
+                try disk_image.copyFromImage(entry, &self.payload.writer, disk_image.exactTextMode());
+                return self.payload.written();
+            },
+            .put => {
+                try slot.freshDirectory(self.pool.io, &lock);
+                var contents: std.Io.Reader = .fixed(self.data.items);
+                try disk_image.copyToImageSized(&contents, self.data.items.len, name, user orelse 0, true, disk_image.exactTextMode());
+                return &.{};
+            },
+            .erase => {
+                try slot.freshDirectory(self.pool.io, &lock);
+                const entry = disk_image.directory.findByFilename(name, user) orelse return error.FileNotFound;
+                try disk_image.erase(entry);
+                return &.{};
+            },
+            .read_sector => {
+                const location: PhysicalAddress = .{ .track = request.track, .sector = request.sector };
+                try disk_image.readSector(location, &self.sector);
+                return self.sector.rawBytes();
+            },
+            .write_sector => {
+                const location: PhysicalAddress = .{ .track = request.track, .sector = request.sector };
+                try location.validate(disk_image.image_type);
+                self.sector = .initUnformatted(disk_image.image_type, location.track);
+                if (self.data.items.len != self.sector.rawBytes().len) return error.InvalidSectorSize;
+                @memcpy(self.sector.rawBytes(), self.data.items);
+                try disk_image.writeSector(location, &self.sector);
+                // The sector may belong to the directory.
+                slot.directory_stale = true;
+                return &.{};
+            },
+            else => unreachable,
+        }
+    }
+};
+
+/// Clients may only open images below the server's directory, so paths must be relative
+/// and can't contain `..`. Both separators are checked, as either works on Windows.
+fn isConfinedPath(path: []const u8) bool {
+    if (path.len == 0 or std.fs.path.isAbsolute(path) or std.fs.path.isAbsoluteWindows(path)) return false;
+    var components = std.mem.tokenizeAny(u8, path, "/\\");
+    while (components.next()) |component| {
+        if (std.mem.eql(u8, component, "..")) return false;
+    }
+    return true;
+}
+
+const Lock = enum { shared, exclusive };
+
+/// Open images, closed least recently used first when a slot is needed for another image.
+pub const Pool = struct {
+    io: std.Io,
+    gpa: std.mem.Allocator,
+    /// Image paths are relative to this directory.
+    dir: std.Io.Dir,
+    slots: []Slot,
+    /// Held while finding, opening or closing slots, but not while using an image.
+    mutex: std.Io.Mutex = .init,
+    /// Incremented on every acquire(), to find the least recently used slot.
+    clock: u64 = 0,
+
+    pub fn init(io: std.Io, gpa: std.mem.Allocator, dir: std.Io.Dir, size: usize) error{OutOfMemory}!Pool {
+        const slots = try gpa.alloc(Slot, size);
+        for (slots) |*slot| slot.* = .{};
+        return .{ .io = io, .gpa = gpa, .dir = dir, .slots = slots };
+    }
+
+    pub fn deinit(self: *Pool) void {
+        for (self.slots) |*slot| self.empty(slot);
+        self.gpa.free(self.slots);
+    }
+
+    /// Return the slot for the image at `path`, opening it if needed, with its lock held as `lock`.
+    fn acquire(self: *Pool, path: []const u8, lock: Lock) !*Slot {
+        const slot, const needs_open = found: {
+            self.mutex.lockUncancelable(self.io);
+            defer self.mutex.unlock(self.io);
+            self.clock += 1;
+            const found_slot = self.find(path) orelse new_slot: {
+                const new_slot = self.leastRecentlyUsed() orelse return error.PoolBusy;
+                self.empty(new_slot);
+                new_slot.path = try self.gpa.dupe(u8, path);
+                break :new_slot new_slot;
+            };
+            found_slot.users += 1;
+            found_slot.last_used = self.clock;
+            break :found .{ found_slot, !found_slot.is_open };
+        };
+        errdefer self.unuse(slot);
+
+        if (needs_open) {
+            slot.lock.lockUncancelable(self.io);
+            defer slot.lock.unlock(self.io);
+            if (!slot.is_open) {
+                try slot.image.open(self.io, self.gpa, self.dir, path);
+                slot.is_open = true;
+            }
+        }
+        switch (lock) {
+            .shared => slot.lock.lockSharedUncancelable(self.io),
+            .exclusive => slot.lock.lockUncancelable(self.io),
+        }
+        return slot;
+    }
+
+    /// Release a slot returned by acquire(). `lock` is how the lock is held now.
+    fn release(self: *Pool, slot: *Slot, lock: Lock) void {
+        switch (lock) {
+            .shared => slot.lock.unlockShared(self.io),
+            .exclusive => slot.lock.unlock(self.io),
+        }
+        self.unuse(slot);
+    }
+
+    fn unuse(self: *Pool, slot: *Slot) void {
+        self.mutex.lockUncancelable(self.io);
+        defer self.mutex.unlock(self.io);
+        slot.users -= 1;
+    }
+
+    /// Close the image at `path` if it is open.
+    fn close(self: *Pool, path: []const u8) error{ImageBusy}!void {
+        self.mutex.lockUncancelable(self.io);
+        defer self.mutex.unlock(self.io);
+        const slot = self.find(path) orelse return;
+        if (slot.users > 0) return error.ImageBusy;
+        self.empty(slot);
+    }
+
+    fn find(self: *Pool, path: []const u8) ?*Slot {
+        for (self.slots) |*slot| {
+            const slot_path = slot.path orelse continue;
+            if (std.mem.eql(u8, slot_path, path)) return slot;
+        }
+        return null;
+    }
+
+    /// An empty slot, otherwise the least recently used slot that isn't in use.
+    fn leastRecentlyUsed(self: *Pool) ?*Slot {
+        var result: ?*Slot = null;
+        for (self.slots) |*slot| {
+            if (slot.path == null) return slot;
+            if (slot.users > 0) continue;
+            if (result == null or slot.last_used < result.?.last_used) result = slot;
+        }
+        return result;
+    }
+
+    /// Close any image in an unused slot.
+    fn empty(self: *Pool, slot: *Slot) void {
+        std.debug.assert(slot.users == 0);
+        if (slot.is_open) {
+            log.info("Closing image {s}", .{slot.path.?});
+            slot.image.close(self.io);
+        }
+        if (slot.path) |path| self.gpa.free(path);
+        slot.* = .{};
+    }
+};
+
+const Slot = struct {
+    /// Path of the image, or null if the slot is empty.
+    path: ?[]u8 = null,
+    /// Number of requests using or waiting for the image.
+    users: u32 = 0,
+    last_used: u64 = 0,
+    /// Held shared by requests that only read the image, and exclusive by those that write it.
+    lock: std.Io.RwLock = .init,
+    is_open: bool = false,
+    /// Set when raw sector writes may have changed the directory. Only changed while the lock is held exclusive.
+    directory_stale: bool = false,
+    image: OpenImage = undefined,
+
+    /// Reload the directory if it may have changed since it was loaded.
+    /// Reloading needs the lock held exclusive, so a shared lock is swapped for an exclusive one.
+    fn freshDirectory(self: *Slot, io: std.Io, lock: *Lock) (error{OutOfMemory} || DirectoryLoadError)!void {
+        if (!self.directory_stale) return;
+        if (lock.* == .shared) {
+            self.lock.unlockShared(io);
+            self.lock.lockUncancelable(io);
+            lock.* = .exclusive;
+        }
+        if (!self.directory_stale) return;
+        const disk_image = &self.image.disk_image;
+        try disk_image.reuse(disk_image.reader, disk_image.writer, disk_image.image_type);
+        try disk_image.loadDirectories(.full);
+        self.directory_stale = false;
+    }
+};
+
+/// An image file, mapped into memory where possible, with its directory loaded.
+/// There is no sector cache, so the image can be read by several threads at once and
+/// every write goes straight to the image.
+const OpenImage = struct {
+    file: std.Io.File,
+    file_reader: std.Io.File.Reader,
+    file_writer: std.Io.File.Writer,
+    mapped_image: MappedImage,
+    is_mapped: bool,
+    disk_image: DiskImage,
+
+    fn open(self: *OpenImage, io: std.Io, gpa: std.mem.Allocator, dir: std.Io.Dir, path: []const u8) !void {
+        self.file = try dir.openFile(io, path, .{ .mode = .read_write });
+        errdefer self.file.close(io);
+        var unique = false;
+        const image_type = DiskImage.detectImageType(io, self.file, &unique) orelse return error.CantDetectImage;
+        log.info("Image type of {s} detected as: {s}", .{ path, image_type.type_name });
+
+        self.file_reader = self.file.reader(io, &.{});
+        self.file_writer = self.file.writer(io, &.{});
+        self.is_mapped = false;
+        if (self.mapped_image.init(io, self.file, image_type, true)) {
+            self.is_mapped = true;
+        } else |err| {
+            log.info("Not memory mapping image: {t}", .{err});
+        }
+        errdefer if (self.is_mapped) self.mapped_image.deinit();
+
+        const reader: SeekableReader = if (self.is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_reader };
+        const writer: SeekableWriter = if (self.is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_writer };
+        self.disk_image = try DiskImage.init(gpa, reader, writer, image_type);
+        errdefer self.disk_image.deinit();
+        try self.disk_image.loadDirectories(.full);
+    }
+
+    fn close(self: *OpenImage, io: std.Io) void {
+        self.disk_image.flush() catch |err| {
+            log.err("Unable to write back image: {t}", .{err});
+        };
+        self.disk_image.deinit();
+        if (self.is_mapped) self.mapped_image.deinit();
+        self.file.close(io);
+    }
+};
+
+const std = @import("std");
+const log = std.log.scoped(.altair_disk_lib);
+const di = @import("disk_image.zig");
+const DiskImage = di.DiskImage;
+const MappedImage = di.MappedImage;
+const SeekableReader = di.SeekableReader;
+const SeekableWriter = di.SeekableWriter;
+const disk_types = @import("disk_types.zig");
+const DiskSector = disk_types.DiskSector;
+const PhysicalAddress = disk_types.PhysicalAddress;
+const directory_table = @import("directory_table.zig");
+const CookedDirEntry = directory_table.CookedDirEntry;
+const DirectoryLoadError = directory_table.DirectoryTable.DirectoryLoadError;
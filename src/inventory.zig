@@ -0,0 +1,193 @@
+//! Catalogue every file on every disk image in a directory tree.
+//! Images are shared out between a fixed number of worker threads, each of which
+//! reuses a single DiskImage (and so its directory table memory) for all the images it loads.
+//! One tab separated record is written to stdout per file:
+//!   image  type  user  filename  size  allocations  [hash]
+//! The hash of the file contents (see file_hash.zig) is only included if requested,
+//! so that copies of the same file can be found across images.
+
+/// Size of each worker's record buffer. Records are written to stdout a buffer at a time.
+const record_buffer_size = 16 * 1024;
+
+pub const Stats = struct {
+    images: usize = 0,
+    files: usize = 0,
+    failed: usize = 0,
+};
+
+/// Scan all images below `root_path` using `jobs` worker threads, or one per CPU if null.
+/// Images that can't be loaded are reported on stderr (unless `quiet`) and skipped.
+pub fn run(io: std.Io, gpa: std.mem.Allocator, root_path: []const u8, jobs: ?u16, hash: bool, quiet: bool) !Stats {
+    var arena: std.heap.ArenaAllocator = .init(gpa);
+    defer arena.deinit();
+    const paths = try findImages(io, arena.allocator(), root_path);
+
+    var stdout_writer = std.Io.File.stdout().writerStreaming(io, &.{});
+    var scan: Scan = .{ .io = io, .paths = paths, .stdout = &stdout_writer.interface, .hash = hash, .quiet = quiet };
+    const workers = try gpa.alloc(Worker, Workers.count(jobs, paths.len));
+    defer gpa.free(workers);
+    for (workers) |*worker| worker.* = .{ .scan = &scan, .gpa = gpa };
+    try Workers.runAll(gpa, Worker, workers);
+
+    var stats: Stats = .{};
+    for (workers) |*worker| {
+        stats.images += worker.stats.images;
+        stats.files += worker.stats.files;
+        stats.failed += worker.stats.failed;
+    }
+    return stats;
+}
+
+/// Return the path of every regular file below `root_path`.
+fn findImages(io: std.Io, arena: std.mem.Allocator, root_path: []const u8) ![]const []const u8 {
+    var root = try std.Io.Dir.cwd().openDir(io, root_path, .{ .iterate = true });
+    defer root.close(io);
+    var walker = try root.walk(arena);
+    defer walker.deinit();
+
+    var paths: std.ArrayList([]const u8) = .empty;
+    while (try walker.next(io)) |entry| {
+        if (entry.kind == .file) {
+            try paths.append(arena, try std.fs.path.join(arena, &.{ root_path, entry.path }));
+        }
+    }
+    return paths.items;
+}
+
+/// State shared by all the workers.
+const Scan = struct {
+    io: std.Io,
+    paths: []const []const u8,
+    /// Records are written here, rather than to the Console, so they never interleave with logging.
+    stdout: *std.Io.Writer,
+    /// Add the hash of each file's contents to its record.
+    hash: bool,
+    quiet: bool,
+    /// Index of the next path to be scanned.
+    next_path: std.atomic.Value(usize) = .init(0),
+    /// Held while writing a worker's buffered records to stdout.
+    output_mutex: std.Io.Mutex = .init,
+
+    fn takePath(self: *Scan) ?[]const u8 {
+        const i = self.next_path.fetchAdd(1, .monotonic);
+        return if (i < self.paths.len) self.paths[i] else null;
+    }
+};
+
+const Worker = struct {
+    scan: *Scan,
+    gpa: std.mem.Allocator,
+    stats: Stats = .{},
+    /// Loaded once and then reused for every image this worker scans.
+    disk_image: ?DiskImage = null,
+    file_reader: std.Io.File.Reader = undefined,
+    file_writer: std.Io.File.Writer = undefined,
+    mapped_image: MappedImage = undefined,
+    record_buffer: [record_buffer_size]u8 = undefined,
+    records: std.Io.Writer = undefined,
+
+    fn run(self: *Worker) void {
+        self.records = .fixed(&self.record_buffer);
+        defer {
+            self.flushRecords();
+            if (self.disk_image) |*disk_image| disk_image.deinit();
+        }
+        while (self.scan.takePath()) |path| {
+            self.scanImage(path) catch |err| {
+                self.printSkipped(path, err);
+                self.stats.failed += 1;
+                continue;
+            };
+            self.stats.images += 1;
+        }
+    }
+
+    fn scanImage(self: *Worker, path: []const u8) !void {
+        const io = self.scan.io;
+        const file = try std.Io.Dir.cwd().openFile(io, path, .{ .mode = .read_only });
+        defer file.close(io);
+
+        var unique = false;
+        const image_type = DiskImage.detectImageType(io, file, &unique) orelse return error.CantDetectImage;
+
+        self.file_reader = file.reader(io, &.{});
+        self.file_writer = file.writer(io, &.{});
+        const is_mapped = if (self.mapped_image.init(io, file, image_type, false)) true else |_| false;
+        defer if (is_mapped) self.mapped_image.deinit();
+        const reader: SeekableReader = if (is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_reader };
+        const writer: SeekableWriter = if (is_mapped) .{ .mapped = &self.mapped_image } else .{ .on_disk = &self.file_writer };
+
+        const disk_image = if (self.disk_image) |*disk_image| disk_image: {
+            try disk_image.reuse(reader, writer, image_type);
+            break :disk_image disk_image;
+        } else disk_image: {
+            self.disk_image = try DiskImage.init(self.gpa, reader, writer, image_type);
+            break :disk_image &self.disk_image.?;
+        };
+        try disk_image.loadDirectories(.full);
+
+        for (disk_image.directory.cooked_directories.items) |*entry| {
+            const digest: ?FileHash.Digest = if (self.scan.hash) FileHash.hashFile(disk_image, entry) catch |err| digest: {
+                self.printNotHashed(path, entry, err);
+                break :digest null;
+            } else null;
+            self.writeRecord(path, image_type, entry, digest);
+            self.stats.files += 1;
+        }
+    }
+
+    /// Add a record to the buffer, writing out the buffer first if the record doesn't fit.
+    fn writeRecord(self: *Worker, path: []const u8, image_type: *const DiskImageType, entry: *const CookedDirEntry, digest: ?FileHash.Digest) void {
+        const start = self.records.end;
+        self.printRecord(path, image_type, entry, digest) catch {
+            self.records.end = start;
+            self.flushRecords();
+            self.printRecord(path, image_type, entry, digest) catch {
+                self.printSkipped(path, error.RecordTooLong);
+                self.records.end = 0;
+            };
+        };
+    }
+
+    fn printRecord(self: *Worker, path: []const u8, image_type: *const DiskImageType, entry: *const CookedDirEntry, digest: ?FileHash.Digest) std.Io.Writer.Error!void {
+        try self.records.print("{s}\t{s}\t{d}\t{s}\t{d}\t{d}", .{ path, image_type.type_name, entry.user, entry.filenameAndExtension(), entry.size_in_bytes, entry.allocations.items.len });
+        if (self.scan.hash) {
+            if (digest) |d| try self.records.print("\t{x:0>16}", .{d.hash}) else try self.records.writeAll("\t-");
+        }
+        try self.records.writeByte('\n');
+    }
+
+    fn flushRecords(self: *Worker) void {
+        const io = self.scan.io;
+        self.scan.output_mutex.lockUncancelable(io);
+        defer self.scan.output_mutex.unlock(io);
+        self.scan.stdout.writeAll(self.records.buffered()) catch {};
+        self.records.end = 0;
+    }
+
+    fn printSkipped(self: *Worker, path: []const u8, err: anyerror) void {
+        if (self.scan.quiet) return;
+        Console.lock();
+        defer Console.unlock();
+        Console.stderr().print("Skipping {s}: {t}\n", .{ path, err }) catch {};
+    }
+
+    fn printNotHashed(self: *Worker, path: []const u8, entry: *const CookedDirEntry, err: anyerror) void {
+        if (self.scan.quiet) return;
+        Console.lock();
+        defer Console.unlock();
+        Console.stderr().print("Can't hash {s} on {s}: {t}\n", .{ entry.filenameAndExtension(), path, err }) catch {};
+    }
+};
+
+const std = @import("std");
+const di = @import("disk_image.zig");
+const DiskImage = di.DiskImage;
+const MappedImage = di.MappedImage;
+const SeekableReader = di.SeekableReader;
+const SeekableWriter = di.SeekableWriter;
+const DiskImageType = @import("disk_types.zig").DiskImageType;
+const CookedDirEntry = @import("directory_table.zig").CookedDirEntry;
+const Console = @import("console.zig");
+const Workers = @import("workers.zig");
+const FileHash = @import("file_hash.zig");
@@ -4,6 +4,7 @@ pub const disk_image = @import("disk_image.zig");
 pub const disk_types = @import("disk_types.zig");
 pub const directory_table = @import("directory_table.zig");
 pub const host_os = @import("host_os.zig");
+pub const SectorCache = @import("sector_cache.zig");
 pub const DiskImage = disk_image.DiskImage;
 pub const DiskImageType = disk_types.DiskImageType;
 pub const DiskImageTypes = disk_types.DiskImageTypes;
@@ -71,6 +71,11 @@ pub const CommandLineOptions = struct {
     recovery_image_file: []const u8 = "",
     get_out_dir: []const u8 = "",
     disk_label: []const u8 = "",
+    batch_file: []const u8 = "",
+    transfer_image: []const u8 = "",
+    diff_image: []const u8 = "",
+    transfer_image_type: ?ImageType = null,
+    sync_dir: []const u8 = "",
     // All command options need to be in the format do_xxxx to be
     // included in the dispatch table.
     do_directory: bool = false,
@@ -88,15 +93,30 @@ pub const CommandLineOptions = struct {
     do_recover: bool = false,
     do_label_get: bool = false,
     do_label_set: bool = false,
+    do_batch: bool = false,
+    do_inventory: bool = false,
+    do_serve: bool = false,
+    do_export_tar: bool = false,
+    do_import_tar: bool = false,
+    do_transfer: bool = false,
+    do_diff: bool = false,
+    do_hash: bool = false,
+    do_defragment: bool = false,
+    do_sync: bool = false,
     text_mode: bool = false,
     bin_mode: bool = false,
     rand_mode: bool = false,
     basic_mode: bool = false,
+    sync_delete: bool = false,
     quiet: bool = false,
     verbose: bool = false,
     very_verbose: bool = false,
     force: bool = false,
+    no_mmap: bool = false,
+    in_memory: bool = false,
+    verify: bool = false,
     cpm_user: ?u8 = null,
+    jobs: ?u16 = null,
     disk_image_type: ?ImageType = null,
 };
 
@@ -115,7 +135,7 @@ pub fn main(init_args: std.process.Init) !void {
                         .required = try r.allocPositionalArgs(&.{
                             .{
                                 .name = "disk_image",
-                                .help = "Filename of Altair disk image",
+                                .help = "Filename of Altair disk image (or directory of images for --inventory, or socket for --serve)",
                                 .value_ref = r.mkRef(&options.image_file),
                             },
                         }),
@@ -295,12 +315,105 @@ pub fn main(init_args: std.process.Init) !void {
                     .short_alias = 'l',
                     .value_ref = r.mkRef(&options.do_label_get),
                 },
+                .{
+                    .long_name = "batch",
+                    .help = "Run each command in a script file (or - for stdin) against the image. e.g. 'put -u 1 FILE.TXT'",
+                    .short_alias = 'B',
+                    .value_name = "script",
+                    .value_ref = r.mkRef(&options.batch_file),
+                },
+                .{
+                    .long_name = "export-tar",
+                    .help = "Write all files on the image to stdout as a tar archive. CP/M files are in a directory per user",
+                    .value_ref = r.mkRef(&options.do_export_tar),
+                },
+                .{
+                    .long_name = "import-tar",
+                    .help = "Copy all files in a tar archive read from stdin to the image. Files in a directory named 0 - 15 are copied to that user",
+                    .value_ref = r.mkRef(&options.do_import_tar),
+                },
+                .{
+                    .long_name = "transfer",
+                    .help = "Copy files (default all) directly to another existing image, which can be a different format",
+                    .short_alias = 'X',
+                    .value_name = "to_image",
+                    .value_ref = r.mkRef(&options.transfer_image),
+                },
+                .{
+                    .long_name = "to-type",
+                    .help = "Disk image type of the --transfer image, if it can't be auto-detected. e.g. " ++ all_disk_type_names[@intFromEnum(ImageType.HDD_5MB_1024)],
+                    .value_ref = r.mkRef(&options.transfer_image_type),
+                    .value_name = "type",
+                },
+                .{
+                    .long_name = "diff",
+                    .help = "List the files that differ between the image and a later copy of it, which must be the same type",
+                    .value_name = "new_image",
+                    .value_ref = r.mkRef(&options.diff_image),
+                },
+                .{
+                    .long_name = "defragment",
+                    .help = "Move every file into consecutive allocations, packed together at the start of the image. Not supported for Altair DOS",
+                    .short_alias = 'D',
+                    .value_ref = r.mkRef(&options.do_defragment),
+                },
+                .{
+                    .long_name = "sync",
+                    .help = "Copy the files in a host directory to the image, skipping files that are already the same on the image",
+                    .short_alias = 'S',
+                    .value_name = "host_dir",
+                    .value_ref = r.mkRef(&options.sync_dir),
+                },
+                .{
+                    .long_name = "delete",
+                    .help = "With --sync, also erase files on the image that are not in the host directory",
+                    .value_ref = r.mkRef(&options.sync_delete),
+                },
+                .{
+                    .long_name = "inventory",
+                    .help = "List every file on every disk image in the directory tree, one tab separated line per file",
+                    .short_alias = 'I',
+                    .value_ref = r.mkRef(&options.do_inventory),
+                },
+                .{
+                    .long_name = "serve",
+                    .help = "Serve images to clients on the Unix domain socket given in place of the image filename, until stopped",
+                    .value_ref = r.mkRef(&options.do_serve),
+                },
+                .{
+                    .long_name = "hash",
+                    .help = "List the hash, size, user and name of files (default all). With --inventory, add a hash to each file",
+                    .short_alias = 'H',
+                    .value_ref = r.mkRef(&options.do_hash),
+                },
+                .{
+                    .long_name = "jobs",
+                    .help = "Number of worker threads for --inventory, --hash, --get-multiple, --put-multiple and --sync. Defaults to one per CPU",
+                    .short_alias = 'j',
+                    .value_name = "threads",
+                    .value_ref = r.mkRef(&options.jobs),
+                },
                 .{
                     .long_name = "force",
                     .help = "Force overwrite of existing files with get or put",
                     .short_alias = 'f',
                     .value_ref = r.mkRef(&options.force),
                 },
+                .{
+                    .long_name = "no-mmap",
+                    .help = "Access the image file directly rather than memory mapping it",
+                    .value_ref = r.mkRef(&options.no_mmap),
+                },
+                .{
+                    .long_name = "in-memory",
+                    .help = "Work on a copy of the image in memory and only write back changes if successful",
+                    .value_ref = r.mkRef(&options.in_memory),
+                },
+                .{
+                    .long_name = "verify",
+                    .help = "Verify sector checksums on MITS 8\" and minidisk images as they are read",
+                    .value_ref = r.mkRef(&options.verify),
+                },
             },
         },
         .version = "0.10.0",
@@ -332,6 +445,10 @@ pub fn validateOptions() !bool {
     options.do_cpm_put = options.system_image_put.len != 0;
     options.do_recover = options.recovery_image_file.len != 0;
     options.do_label_set = options.disk_label.len != 0;
+    options.do_batch = options.batch_file.len != 0;
+    options.do_transfer = options.transfer_image.len != 0;
+    options.do_diff = options.diff_image.len != 0;
+    options.do_sync = options.sync_dir.len != 0;
 
     // Can only by one of directory, get/multi, put/multi, etc
     const single_options = [_]bool{
@@ -340,6 +457,10 @@ pub fn validateOptions() !bool {
         options.do_put,         options.do_put_multi, options.do_raw_dir,
         options.do_cpm_get,     options.do_cpm_put,   options.do_recover,
         options.do_information, options.do_label_get, options.do_label_set,
+        options.do_batch,       options.do_inventory, options.do_export_tar,
+        options.do_import_tar,  options.do_transfer,  options.do_diff,
+        options.do_hash,        options.do_defragment, options.do_sync,
+        options.do_serve,
     };
 
     // For windows do some simple globbing for put multiple
@@ -366,6 +487,10 @@ pub fn validateOptions() !bool {
         option_count -= 1;
         options.do_label_set = false;
     }
+    if (options.do_inventory and options.do_hash) {
+        // Inventory will add the hashes.
+        option_count -= 1;
+    }
 
     if (option_count == 0) {
         // Default to directory listing
@@ -389,13 +514,18 @@ pub fn validateOptions() !bool {
             \\       --extract-os, --write-os,
             \\       --label, --recover
             \\       --label-set (except with --format),
+            \\       --batch, --inventory, --export-tar, --import-tar,
+            \\       --transfer, --diff, --hash (except with --inventory),
+            \\       --defragment, --sync, --serve
             \\
         , .{});
         return false;
     }
 
     if (options.do_directory or options.do_raw_dir or options.do_information or
-        options.do_format or options.do_label_get or options.do_label_set)
+        options.do_format or options.do_label_get or options.do_label_set or options.do_batch or
+        options.do_inventory or options.do_export_tar or options.do_import_tar or options.do_diff or
+        options.do_defragment or options.do_sync or options.do_serve)
     {
         if (options.multiple_files.len != 0) {
             cli.printError(&p, &app,
@@ -406,6 +536,14 @@ pub fn validateOptions() !bool {
                 \\       --format
                 \\       --label
                 \\       --label-set
+                \\       --batch
+                \\       --inventory
+                \\       --export-tar
+                \\       --import-tar
+                \\       --diff
+                \\       --defragment
+                \\       --sync
+                \\       --serve
             , .{});
             return false;
         }
@@ -420,6 +558,14 @@ pub fn validateOptions() !bool {
             return false;
         }
     }
+    if (options.transfer_image_type != null and !options.do_transfer) {
+        cli.printError(&p, &app, "You may only use --to-type with --transfer", .{});
+        return false;
+    }
+    if (options.sync_delete and !options.do_sync) {
+        cli.printError(&p, &app, "You may only use --delete with --sync", .{});
+        return false;
+    }
     if (options.get_out_dir.len != 0 and !(options.do_get or options.do_get_multi)) {
         cli.printError(&p, &app,
             \\You may only use --out with:
@@ -437,7 +583,7 @@ pub fn validateOptions() !bool {
     }
 
     if (options.force and
-        !(options.do_get or options.do_put or options.do_get_multi or options.do_put_multi))
+        !(options.do_get or options.do_put or options.do_get_multi or options.do_put_multi or options.do_import_tar or options.do_transfer))
     {
         cli.printError(&p, &app, "force can only be used with get or put operations", .{});
         return false;
@@ -469,6 +615,9 @@ pub fn log(
         else => return std.debug.print(@tagName(message_level) ++ ": " ++ @tagName(scope) ++ ": " ++ format, args),
     }
     if (options.quiet) return;
+    // Messages may be logged from worker threads, e.g. for --inventory.
+    Console.lock();
+    defer Console.unlock();
     switch (message_level) {
         .info, .warn => {
             if (options.verbose) {
@@ -306,7 +306,8 @@ pub const DirEntry = extern struct {
                             return error.InvalidImageFile;
                         };
                         const nr_groups: u32 = sector.data.nbytes;
-                        nbytes = nr_groups * image.image_type.block_size;
+                        // The group map in the first two sectors isn't part of the file, and isn't copied from the image.
+                        nbytes = (nr_groups * image.image_type.block_size) -| 2 * @as(u32, image.image_type.sector_size_data);
                         used = nr_groups;
                         @memcpy(group_map[0..128], sector.dataBytes());
 
@@ -449,7 +450,7 @@ pub fn loadDirectory(image: *DiskImage, option: DirectoryTable.LoadOption) Direc
             255 => break :loop, // End of Directory
             else => {
                 const raw_entry_idx = (@intFromPtr(entry) - @intFromPtr(&dir.raw_directories.ados.items[0])) / @sizeOf(DirEntry);
-                dir.cooked_directories.appendAssumeCapacity(entry.cook(image, @intCast(raw_entry_idx)) catch |err| {
+                dir.appendCookedEntryAssumeCapacity(entry.cook(image, @intCast(raw_entry_idx)) catch |err| {
                     if (option != .raw_only) {
                         return err;
                     } else {
@@ -465,6 +466,7 @@ pub fn loadDirectory(image: *DiskImage, option: DirectoryTable.LoadOption) Direc
             return std.mem.lessThan(u8, lhs.filenameAndExtension(), rhs.filenameAndExtension());
         }
     }.lessThan);
+    dir.reindexCookedEntries();
 }
 
 /// Convert to valid Altair DOS / Basic filename
@@ -663,7 +665,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
     // FUTURE TODO: The handling of cooked dirs here is very fragile. move this into a fucntion and handled cooked dirs outside of it?
     if (nbytes == 0) {
         try rawEntryWrite(image, extent_nr);
-        image.directory.cooked_directories.appendAssumeCapacity(try new_entry.cook(image, extent_nr));
+        image.directory.appendCookedEntryAssumeCapacity(try new_entry.cook(image, extent_nr));
         return;
     }
 
@@ -684,7 +686,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
 
     // Always try and create the cooked directory with whatever info we have to hand.
     errdefer blk: {
-        image.directory.cooked_directories.appendAssumeCapacity(new_entry.cook(image, extent_nr) catch break :blk);
+        image.directory.appendCookedEntryAssumeCapacity(new_entry.cook(image, extent_nr) catch break :blk);
     }
     var prev_location: ?PhysicalAddress = null;
     var prev_sector: DiskSector = undefined;
@@ -762,7 +764,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
         try image.writeSector(group_map_location, &sector);
     }
 
-    image.directory.cooked_directories.appendAssumeCapacity(try new_entry.cook(image, extent_nr));
+    image.directory.appendCookedEntryAssumeCapacity(try new_entry.cook(image, extent_nr));
     // The ADOS file allocation is fairly simple for sequential files.
     // 1) The directory entry holds a pointer to the first track and sector for the file.
     // 2) All sectors containing file data, have the directory entry number (starting at 1) set as the file number
@@ -788,6 +790,7 @@ pub fn rawEntryWrite(image: *DiskImage, extent_nr: u16) (WriteSectorError || Raw
     if (!this_entry.isDeleted()) {
         try this_entry.validate(image.image_type, extent_nr);
     }
+    if (image.deferRawEntryWrite(extent_nr)) return;
 
     // 16 bytes per directory entry. Directory start at Track 70
     const location: PhysicalAddress = .{ .track = image.image_type.OS.ados.directory_track, .sector = extent_nr / entries_per_sector };
@@ -836,14 +839,11 @@ pub fn allocationGetFree(dir: *DirectoryTable, for_random_access: bool) error{ O
     const allocs_per_track = dir.image_type.sectors_per_track / dir.image_type.sectors_per_alloc;
 
     if (!for_random_access) {
-        for (dir.image_type.OS.ados.directory_track + 1..dir.image_type.tracks) |track_nr| {
-            for (0..allocs_per_track) |alloc_in_track| {
-                const alloc_nr = (track_nr - dir.image_type.reserved_tracks) * allocs_per_track + alloc_in_track;
-                if (dir.free_allocations.isSet(alloc_nr)) {
-                    try unsetAllocation(dir, @intCast(alloc_nr));
-                    return @intCast(alloc_nr);
-                }
-            }
+        // Allocations above the directory track are numbered contiguously, so can search the bitset directly.
+        const first_alloc = (dir.image_type.OS.ados.directory_track + 1 - dir.image_type.reserved_tracks) * allocs_per_track;
+        if (dir.allocationFindFree(first_alloc)) |alloc_nr| {
+            try unsetAllocation(dir, alloc_nr);
+            return alloc_nr;
         }
 
         // Then look for free allocs from track 69 downwards
@@ -889,12 +889,15 @@ fn setAllocation(dir: *DirectoryTable, alloc: u16) error{InvalidAllocation}!void
         return error.InvalidAllocation;
     }
     std.debug.assert(!dir.free_allocations.isSet(alloc));
-    dir.free_allocations.set(alloc);
+    dir.allocationFreed(alloc);
 }
 
 pub fn rawEntryGetFreeInitialized(image: *DiskImage, extent_nr: *u16) error{OutOfExtents}!*DirEntry {
     const dir = &image.directory;
-    for (dir.raw_directories.ados.items[0..dir.raw_directories.ados.items.len -| 1], 0..) |*entry, i| {
+    const start = @min(dir.free_entry_cursor, dir.raw_directories.ados.items.len -| 1);
+    for (dir.raw_directories.ados.items[start .. dir.raw_directories.ados.items.len -| 1], start..) |*entry, i| {
+        // The entry isn't marked as used until the caller fills it in.
+        dir.free_entry_cursor = @intCast(i);
         if (entry.isLastEntry()) {
             extent_nr.* = @intCast(i);
             entry.* = .last;
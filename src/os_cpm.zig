@@ -609,9 +609,7 @@ pub fn loadDirectory(image: *DiskImage, option: DirectoryTable.LoadOption) Direc
     }
 
     // Note you cannot rely on this list remaining sorted during any operation that manipulates the
-    // raw directory entries. Filename searches will need to traverse the whole list.
-    // If this starts getting used alot, it would be worth making it a HashArray to give easy lookups, while still
-    // keeping the contents stored in a sortable array.
+    // raw directory entries. Filename searches use the filename index instead.
     std.mem.sort(CookedDirEntry, dir.cooked_directories.items, {}, struct {
         fn lessThan(_: void, lhs: CookedDirEntry, rhs: CookedDirEntry) bool {
             if (!std.mem.eql(u8, lhs.filenameAndExtension(), rhs.filenameAndExtension())) {
@@ -620,6 +618,7 @@ pub fn loadDirectory(image: *DiskImage, option: DirectoryTable.LoadOption) Direc
             return lhs.user < rhs.user;
         }
     }.lessThan);
+    dir.reindexCookedEntries();
 }
 
 /// Whenever a new extent is created, register it with the directory
@@ -628,7 +627,7 @@ pub fn buildCookedEntry(dir: *DirectoryTable, raw_entry_idx: u16) (error{ OutOfM
     const entry = &dir.raw_directories.cpm.items[raw_entry_idx];
     try entry.validate(dir.image_type, raw_entry_idx);
     if (entry.isFirstEntryForFile(dir.image_type)) {
-        try dir.cooked_directories.append(dir.allocator(), try entry.cook(dir.allocator(), dir.image_type));
+        try dir.appendCookedEntry(try entry.cook(dir.allocator(), dir.image_type));
     } else {
         if (dir.cooked_directories.items.len == 0) {
             logerr("Cannot detect first entry for file {s}.{s}: ", .{ entry.filename, entry.filetype });
@@ -732,60 +731,78 @@ pub fn copyFromImage(image: *DiskImage, entry: *const CookedDirEntry, out_writer
     }
     const recs_per_sector = (image.image_type.sector_size_data / 128); // Recs always represent 128 bytes
     const num_sectors = (num_records + recs_per_sector - 1) / recs_per_sector;
-    var total_rec_nr: u16 = 0;
-    for (0..num_sectors) |sec_nr| {
-        // We should not longer be able to trigger this. Left for safety.
-        const alloc_idx = total_rec_nr / image.image_type.recs_per_alloc;
-        if (alloc_idx >= entry.allocations.items.len) {
-            logerr("FATAL ERROR: num_records = {}, num_sectors = {}, total_rec_nr = {}, alloc_idx = {}, recs_per_alloc = {}, allocs.len = {}, total_allocs = {} num records = {}\n", .{
-                num_records,
-                num_sectors,
-                total_rec_nr,
-                alloc_idx,
-                image.image_type.recs_per_alloc,
-                entry.allocations.items.len,
-                image.image_type.total_allocs,
-                entry.os.cpm.num_records,
-            });
-            return error.InvalidRecordNumber;
+
+    // Sectors are planned in batches in logical order, then read in physical order
+    // so that a batch only needs a few large reads rather than a seek and read per sector.
+    var locations: [DiskImage.max_batch_sectors]PhysicalAddress = undefined;
+    var sectors: [DiskImage.max_batch_sectors]DiskSector = undefined;
+    var span_buffer: [DiskImage.max_batch_sectors * DiskSector.sector_size_max]u8 = undefined;
+
+    var batch_start: usize = 0;
+    var last_alloc_found = false;
+    while (batch_start < num_sectors and !last_alloc_found) {
+        var batch_len: usize = 0;
+        while (batch_len < locations.len and batch_start + batch_len < num_sectors) : (batch_len += 1) {
+            const sec_nr = batch_start + batch_len;
+            const total_rec_nr = sec_nr * recs_per_sector;
+            // We should not longer be able to trigger this. Left for safety.
+            const alloc_idx = total_rec_nr / image.image_type.recs_per_alloc;
+            if (alloc_idx >= entry.allocations.items.len) {
+                logerr("FATAL ERROR: num_records = {}, num_sectors = {}, total_rec_nr = {}, alloc_idx = {}, recs_per_alloc = {}, allocs.len = {}, total_allocs = {} num records = {}\n", .{
+                    num_records,
+                    num_sectors,
+                    total_rec_nr,
+                    alloc_idx,
+                    image.image_type.recs_per_alloc,
+                    entry.allocations.items.len,
+                    image.image_type.total_allocs,
+                    entry.os.cpm.num_records,
+                });
+                return error.InvalidRecordNumber;
+            }
+            const alloc = entry.allocations.items[alloc_idx];
+            if (alloc == 0) {
+                last_alloc_found = true;
+                break;
+            }
+            locations[batch_len] = toPhysicalAddress(image, .{ .record = @intCast(sec_nr % image.image_type.recs_per_alloc), .allocation = alloc });
         }
-        const alloc = entry.allocations.items[alloc_idx];
-        if (alloc == 0)
-            break;
-        var sector: DiskSector = undefined;
-        try readSectorLogical(image, .{ .record = @intCast(sec_nr % image.image_type.recs_per_alloc), .allocation = alloc }, &sector);
-        // If it is the last sector. then adjust the data length to the 128B record count, rather than just assuming a full sector
-        var data_len: usize = if (sec_nr == num_sectors - 1)
-            (((num_records - 1) % recs_per_sector) + 1) * 128
-        else
-            sector.dataLen();
-        const check_for_text = text_mode != .Binary;
-
-        // CPM doesn't actually know how long a file is, except in multiples of 128 byte records.
-        // So if it is a text file looks for ^Z anywhere in the last sector and use that
-        // to mark the EOF. For binary files it doesn't matter if they are too long.
-        // Really we only need to check the last record (128 bytes), but we check the whole last sector.
-        if (check_for_text and sec_nr == num_sectors - 1) {
-            for (sector.dataBytes(), 0..) |b, i| {
-                if (text_mode == .Auto) {
-                    if (b & 0x80 != 0) {
-                        break;
+        try image.readSectorBatch(locations[0..batch_len], sectors[0..batch_len], &span_buffer);
+
+        for (sectors[0..batch_len], batch_start..) |*sector, sec_nr| {
+            // If it is the last sector. then adjust the data length to the 128B record count, rather than just assuming a full sector
+            var data_len: usize = if (sec_nr == num_sectors - 1)
+                (((num_records - 1) % recs_per_sector) + 1) * 128
+            else
+                sector.dataLen();
+            const check_for_text = text_mode != .Binary;
+
+            // CPM doesn't actually know how long a file is, except in multiples of 128 byte records.
+            // So if it is a text file looks for ^Z anywhere in the last sector and use that
+            // to mark the EOF. For binary files it doesn't matter if they are too long.
+            // Really we only need to check the last record (128 bytes), but we check the whole last sector.
+            if (check_for_text and sec_nr == num_sectors - 1) {
+                for (sector.dataBytes(), 0..) |b, i| {
+                    if (text_mode == .Auto) {
+                        if (b & 0x80 != 0) {
+                            break;
+                        }
                     }
-                }
 
-                if (b == 0x1a) {
-                    data_len = i;
-                    break;
+                    if (b == 0x1a) {
+                        data_len = i;
+                        break;
+                    }
                 }
             }
+            try out_writer.writeAll(sector.dataBytes()[0..data_len]);
         }
-        try out_writer.writeAll(sector.dataBytes()[0..data_len]);
-        total_rec_nr += recs_per_sector;
+        batch_start += batch_len;
     }
 }
 
 pub const CopyToImageError = (error{ InvalidImageFile, PathAlreadyExists, InvalidFilename, OutOfExtents, OutOfMemory } || DiskImage.EraseError || DirectoryTable.DirectoryError);
-pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename: []const u8, user: ?u8, force: bool) CopyToImageError!void {
+pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, size: ?u64, to_filename: []const u8, user: ?u8, force: bool) CopyToImageError!void {
     const cpm_user = user orelse 0;
     const basename = std.fs.path.basename(to_filename);
     var conversion_buf: [CookedDirEntry.filename_max]u8 = undefined;
@@ -829,6 +846,17 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
         return;
     }
 
+    // If the size is known, store the file in the best fitting run of free allocations, so
+    // it can later be read with long sequential reads.
+    // Otherwise, or if there is no large enough run, use the first free allocation each time.
+    var run: ?AllocationRun = null;
+    if (size) |file_size| {
+        const allocs_needed = (file_size + image.image_type.block_size - 1) / image.image_type.block_size;
+        if (image.directory.allocationFindRun(@intCast(allocs_needed))) |run_start| {
+            run = .{ .next = run_start, .end = @intCast(run_start + allocs_needed) };
+        }
+    }
+
     var dir_entry: *DirEntry = undefined;
     while (nbytes != 0) {
         num_records += @intCast((nbytes + 127) / 128);
@@ -845,7 +873,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
         }
         // Is this a new allocation?
         if (record_nr % image.image_type.recs_per_alloc == 0) {
-            alloc_nr = try allocationGetFree(&image.directory);
+            alloc_nr = (if (run) |*r| r.take(&image.directory) else null) orelse try allocationGetFree(&image.directory);
             const raw_entry = &image.directory.raw_directories.cpm.items[extent_nr];
             try raw_entry.allocationSet(alloc_count, alloc_nr, image.image_type);
             alloc_count += 1;
@@ -906,26 +934,40 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
 }
 
 /// Return a free CPM directory entry
-pub fn rawEntryGetFreeInitialized(dir: *const DirectoryTable, extent_nr: *u16) error{OutOfExtents}!*DirEntry {
-    for (dir.raw_directories.cpm.items, 0..) |*entry, i| {
+pub fn rawEntryGetFreeInitialized(dir: *DirectoryTable, extent_nr: *u16) error{OutOfExtents}!*DirEntry {
+    const start = dir.free_entry_cursor;
+    for (dir.raw_directories.cpm.items[start..], start..) |*entry, i| {
         if (entry.isDeleted() and !entry.isLabel()) {
             extent_nr.* = @intCast(i);
             entry.* = .empty;
+            dir.free_entry_cursor = @intCast(i + 1);
             return entry;
         }
     }
+    dir.free_entry_cursor = @intCast(dir.raw_directories.cpm.items.len);
     return error.OutOfExtents;
 }
 
 pub fn allocationGetFree(dir: *DirectoryTable) error{OutOfAllocs}!u16 {
-    if (dir.free_allocations.findFirstSet()) |free_alloc| {
-        dir.free_allocations.unset(free_alloc);
-        return @intCast(free_alloc);
-    } else {
-        return error.OutOfAllocs;
-    }
+    return dir.allocationTakeFirstFree() orelse error.OutOfAllocs;
 }
 
+/// A run of free allocations reserved for a single file.
+const AllocationRun = struct {
+    next: u16,
+    end: u16,
+
+    /// Take the next allocation from the run, or null if the run is used up.
+    /// This can happen if the file grew after its size was taken.
+    fn take(self: *AllocationRun, dir: *DirectoryTable) ?u16 {
+        if (self.next == self.end) return null;
+        std.debug.assert(dir.free_allocations.isSet(self.next));
+        dir.free_allocations.unset(self.next);
+        self.next += 1;
+        return self.next - 1;
+    }
+};
+
 /// write a CPM diretory entry (RawDirEntry)
 pub fn rawEntryWrite(image: *DiskImage, extent_nr: u16) (WriteSectorError || RawDirError)!void {
     // Make sure entry is valid before written.
@@ -933,6 +975,7 @@ pub fn rawEntryWrite(image: *DiskImage, extent_nr: u16) (WriteSectorError || Raw
     if (!this_entry.isDeleted()) {
         try this_entry.validate(image.image_type, extent_nr);
     }
+    if (image.deferRawEntryWrite(extent_nr)) return;
 
     const location = toPhysicalAddress(image, .{ .allocation = extent_nr / image.image_type.dirs_per_alloc, .record = @intCast(extent_nr / image.image_type.dirs_per_sector) });
     var sector: DiskSector = .initFormatted(image.image_type, location);
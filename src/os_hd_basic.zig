@@ -383,7 +383,7 @@ pub fn loadDirectory(arena: std.mem.Allocator, dir: *DirectoryTable, image: *Dis
                 const entry_nr = (@intFromPtr(entry) - @intFromPtr(&dir.raw_directories.hd_basic.items[0])) / @sizeOf(DirEntry);
                 try entry.validate(image.image_type, @intCast(entry_nr));
                 const cooked = try entry.cook(arena, image.image_type, @intCast(entry_nr));
-                dir.cooked_directories.appendAssumeCapacity(cooked);
+                dir.appendCookedEntryAssumeCapacity(cooked);
             }
         }
         std.mem.sort(CookedDirEntry, dir.cooked_directories.items, {}, struct {
@@ -391,6 +391,7 @@ pub fn loadDirectory(arena: std.mem.Allocator, dir: *DirectoryTable, image: *Dis
                 return std.mem.lessThan(u8, lhs.filenameAndExtension(), rhs.filenameAndExtension());
             }
         }.lessThan);
+        dir.reindexCookedEntries();
     } else {
         for (dir.raw_directories.hd_basic.items, 0..) |raw_dir, entry_nr| {
             if (!raw_dir.isDeleted())
@@ -399,7 +400,7 @@ pub fn loadDirectory(arena: std.mem.Allocator, dir: *DirectoryTable, image: *Dis
     }
 }
 
-const ImageFileReader = struct {
+pub const ImageFileReader = struct {
     interface: std.Io.Reader,
     dir_entry: *const CookedDirEntry,
     image: *DiskImage,
@@ -726,7 +727,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
         image.image_type,
         entry_nr,
     );
-    image.directory.cooked_directories.appendAssumeCapacity(cooked);
+    image.directory.appendCookedEntryAssumeCapacity(cooked);
     // If everything else succeeds, return any copy error.
     return copy_err;
 }
@@ -735,9 +736,7 @@ pub fn copyToImage(image: *DiskImage, file_reader: *std.Io.Reader, to_filename:
 /// This needs to be committed to disk in the volume label to make it a permanent allocation
 /// only pub for tests
 pub fn allocationGetFree(dir: *DirectoryTable) error{OutOfAllocs}!u16 {
-    const free = dir.free_allocations.findFirstSet() orelse return error.OutOfAllocs;
-    dir.free_allocations.unset(free);
-    return @intCast(free);
+    return dir.allocationTakeFirstFree() orelse error.OutOfAllocs;
 }
 
 pub fn allocationSetFree(image: *DiskImage, cooked: *const CookedDirEntry, alloc: u16) void {
@@ -787,13 +786,16 @@ fn setAllocation(dir: *DirectoryTable, alloc: u16) error{InvalidAllocation}!void
         return error.InvalidAllocation;
     }
     std.debug.assert(!dir.free_allocations.isSet(alloc));
-    dir.free_allocations.set(alloc);
+    dir.allocationFreed(alloc);
 }
 
-fn rawEntryGetFree(dir: *const DirectoryTable, entry_nr: *u16) error{OutOfExtents}!*DirEntry {
-    for (dir.raw_directories.hd_basic.items, 0..) |*entry, nr| {
+fn rawEntryGetFree(dir: *DirectoryTable, entry_nr: *u16) error{OutOfExtents}!*DirEntry {
+    const start = dir.free_entry_cursor;
+    for (dir.raw_directories.hd_basic.items[start..], start..) |*entry, nr| {
         if (entry.isDeleted()) {
             entry_nr.* = @intCast(nr);
+            // The entry isn't marked as used until the caller fills it in.
+            dir.free_entry_cursor = @intCast(nr);
             return entry;
         }
     }
@@ -885,6 +887,7 @@ pub fn rawEntryWrite(img: *DiskImage, entry_nr: u16) (DiskImage.WriteSectorError
     if (!this_entry.isDeleted()) {
         try this_entry.validate(img.image_type, entry_nr);
     }
+    if (img.deferRawEntryWrite(entry_nr)) return;
     const entry_page = DiskImageType_HD_BASIC.directory_page + entry_nr / image_type.dirs_per_sector;
     const location = toPhysicalAddress(image_type, entry_page);
     var sector: DiskSector = .initFormatted(img.image_type, location);
@@ -904,6 +907,7 @@ pub fn initAllocationMap(sector: *DiskSector, which: enum { first, second }) voi
 }
 
 pub fn writeAllocationBitmap(image: *DiskImage) (ReadSectorError || WriteSectorError)!void {
+    if (image.deferAllocationBitmapWrite()) return;
     var allocation_bitmap: [512]u8 = @splat(0);
     for (&allocation_bitmap, 0..) |*byte, idx| {
         const capacity = image.directory.free_allocations.capacity();
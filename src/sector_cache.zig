@@ -0,0 +1,134 @@
+//! A fixed size write-back cache of disk sectors, keyed by their (logical) track and sector.
+//! Sits underneath DiskImage.readSector() and DiskImage.writeSector() so that
+//! repeated writes of the same sector (e.g. directory sectors) are coalesced
+//! into a single physical write when the cache is flushed.
+//! The cache itself never does any I/O, DiskImage is responsible for writing back dirty sectors.
+
+/// A single cached sector
+pub const Slot = struct {
+    location: PhysicalAddress,
+    sector: DiskSector,
+    dirty: bool,
+};
+
+pub const Stats = struct {
+    hits: usize = 0,
+    misses: usize = 0,
+    writebacks: usize = 0,
+};
+
+/// Enough for the largest directory table of any supported format.
+pub const default_capacity = 256;
+
+slots: []Slot,
+/// Number of slots that have been used at least once.
+used: u16,
+/// Clock hand used to find the next slot to evict.
+hand: u16,
+/// Maps a track and sector to its slot.
+index: std.AutoHashMapUnmanaged(u32, u16),
+/// Scratch space for ordering dirty slots for write-back.
+dirty_order: []*Slot,
+stats: Stats,
+
+const SectorCache = @This();
+
+/// All memory is allocated up-front so that reads and writes never need to allocate.
+pub fn init(gpa: std.mem.Allocator, capacity: u16) error{OutOfMemory}!SectorCache {
+    std.debug.assert(capacity > 0);
+    const slots = try gpa.alloc(Slot, capacity);
+    errdefer gpa.free(slots);
+    const dirty_order = try gpa.alloc(*Slot, capacity);
+    errdefer gpa.free(dirty_order);
+    var index: std.AutoHashMapUnmanaged(u32, u16) = .empty;
+    try index.ensureTotalCapacity(gpa, capacity);
+    return .{
+        .slots = slots,
+        .used = 0,
+        .hand = 0,
+        .index = index,
+        .dirty_order = dirty_order,
+        .stats = .{},
+    };
+}
+
+/// Any dirty sectors are discarded. Flush through the DiskImage first.
+pub fn deinit(self: *SectorCache, gpa: std.mem.Allocator) void {
+    self.index.deinit(gpa);
+    gpa.free(self.dirty_order);
+    gpa.free(self.slots);
+    self.* = undefined;
+}
+
+/// Return the cached sector for `location` if there is one.
+pub fn get(self: *SectorCache, location: PhysicalAddress) ?*Slot {
+    if (self.index.get(key(location))) |slot_nr| {
+        self.stats.hits += 1;
+        return &self.slots[slot_nr];
+    }
+    self.stats.misses += 1;
+    return null;
+}
+
+/// Return the slot to use for `location`. Either the existing slot or an unused / clean slot.
+/// Returns null if all slots are dirty, in which case the caller needs to write them back first.
+pub fn reserve(self: *SectorCache, location: PhysicalAddress) ?*Slot {
+    const location_key = key(location);
+    if (self.index.get(location_key)) |slot_nr| {
+        return &self.slots[slot_nr];
+    }
+    const slot_nr: u16 = slot_nr: {
+        if (self.used < self.slots.len) {
+            self.used += 1;
+            break :slot_nr self.used - 1;
+        }
+        for (0..self.slots.len) |_| {
+            const candidate = self.hand;
+            self.hand = @intCast((self.hand + 1) % self.slots.len);
+            if (!self.slots[candidate].dirty) {
+                _ = self.index.remove(key(self.slots[candidate].location));
+                break :slot_nr candidate;
+            }
+        }
+        return null;
+    };
+    self.index.putAssumeCapacity(location_key, slot_nr);
+    self.slots[slot_nr].location = location;
+    self.slots[slot_nr].dirty = false;
+    return &self.slots[slot_nr];
+}
+
+/// Return the dirty slots sorted by file offset, so they can be written back in file order.
+/// The returned slice is only valid until the next call.
+pub fn dirtySlots(self: *SectorCache, image_type: *const DiskImageType) []*Slot {
+    var count: usize = 0;
+    for (self.slots[0..self.used]) |*slot| {
+        if (slot.dirty) {
+            self.dirty_order[count] = slot;
+            count += 1;
+        }
+    }
+    std.mem.sortUnstable(*Slot, self.dirty_order[0..count], image_type, slotLessThan);
+    return self.dirty_order[0..count];
+}
+
+/// Drop all cached sectors, dirty or not.
+pub fn clear(self: *SectorCache) void {
+    self.index.clearRetainingCapacity();
+    self.used = 0;
+    self.hand = 0;
+}
+
+fn slotLessThan(image_type: *const DiskImageType, lhs: *Slot, rhs: *Slot) bool {
+    return image_type.sectorOffset(lhs.location) < image_type.sectorOffset(rhs.location);
+}
+
+fn key(location: PhysicalAddress) u32 {
+    return @as(u32, location.track) << 16 | location.sector;
+}
+
+const std = @import("std");
+const disk_types = @import("disk_types.zig");
+const DiskImageType = disk_types.DiskImageType;
+const DiskSector = disk_types.DiskSector;
+const PhysicalAddress = disk_types.PhysicalAddress;
@@ -0,0 +1,291 @@
+//! Raw sector access for emulators that mount an image as a drive.
+//! Sectors are read and written whole, including any MITS header and checksum, exactly as the emulated
+//! controller sees them, from a cache of whole tracks. A track that isn't cached is read with a single positional read.
+//! Writes only copy into the cache. Tracks that have been written are written back by a background thread,
+//! so the caller never waits for the image file unless a dirty track has to be evicted.
+//! No checksums are calculated or checked and nothing is known about the directory,
+//! so don't change the image any other way while a SectorDevice has it open.
+
+pub const Options = struct {
+    /// Number of whole tracks to cache.
+    cached_tracks: u16 = default_cached_tracks,
+    /// Translate sectors through the image's skew table, like DiskImage.readSector().
+    /// Turn off if the caller's sector numbers are already the order the sectors are stored in the image.
+    skew: bool = true,
+};
+
+pub const default_cached_tracks = 16;
+
+pub const Stats = struct {
+    hits: u64 = 0,
+    misses: u64 = 0,
+    /// Tracks written back by the background thread.
+    writebacks: u64 = 0,
+    /// Dirty tracks that had to be written back before they could be evicted.
+    evictions: u64 = 0,
+};
+
+pub const Error = error{ InvalidSectorSize, EndOfStream } ||
+    PhysicalAddress.ValidateError ||
+    std.Io.File.ReadPositionalError ||
+    std.Io.File.WritePositionalError;
+
+const no_slot = std.math.maxInt(u16);
+
+const Slot = struct {
+    /// Track held in `data`, or null if the slot is empty.
+    track: ?u16,
+    data: []u8,
+    dirty: bool,
+    last_used: u64,
+};
+
+io: std.Io,
+gpa: std.mem.Allocator,
+file: std.Io.File,
+image_type: *const DiskImageType,
+skew: bool,
+/// Protects everything below. Held while reading a missed track, but not while the background thread writes.
+mutex: std.Io.Mutex,
+/// Signalled when a track becomes dirty, or the background thread should stop.
+work: std.Io.Condition,
+/// Broadcast when the background thread finishes writing a track.
+written: std.Io.Condition,
+slots: []Slot,
+/// Backing memory for the data of every slot and `write_buffer`.
+track_data: []u8,
+/// Index into `slots` for each track of the image, or no_slot.
+track_slots: []u16,
+/// Incremented on every access, to find the least recently used slot.
+clock: u64,
+dirty_count: u16,
+/// Track being written by the background thread, from `write_buffer`.
+writing_track: ?u16,
+write_buffer: []u8,
+/// First error writing back a track in the background. Returned by the next flush().
+write_error: ?Error,
+stopping: bool,
+thread: std.Thread,
+stats: Stats,
+
+const SectorDevice = @This();
+
+/// Open a device on an image file that is already open for reading and writing.
+/// All memory is allocated up-front so that reads and writes never need to allocate.
+/// Note: Caller is responsible for closing the underlying file after deinit()
+pub fn init(self: *SectorDevice, io: std.Io, gpa: std.mem.Allocator, file: std.Io.File, image_type: *const DiskImageType, options: Options) (error{OutOfMemory} || std.Thread.SpawnError)!void {
+    std.debug.assert(options.cached_tracks > 0);
+    const track_len = @max(trackLength(image_type, 0), trackLength(image_type, image_type.tracks - 1));
+    const slots = try gpa.alloc(Slot, options.cached_tracks);
+    errdefer gpa.free(slots);
+    const track_data = try gpa.alloc(u8, track_len * (@as(usize, options.cached_tracks) + 1));
+    errdefer gpa.free(track_data);
+    const track_slots = try gpa.alloc(u16, image_type.tracks);
+    errdefer gpa.free(track_slots);
+    @memset(track_slots, no_slot);
+    for (slots, 0..) |*slot, i| {
+        slot.* = .{ .track = null, .data = track_data[i * track_len ..][0..track_len], .dirty = false, .last_used = 0 };
+    }
+
+    self.* = .{
+        .io = io,
+        .gpa = gpa,
+        .file = file,
+        .image_type = image_type,
+        .skew = options.skew,
+        .mutex = .init,
+        .work = .init,
+        .written = .init,
+        .slots = slots,
+        .track_data = track_data,
+        .track_slots = track_slots,
+        .clock = 0,
+        .dirty_count = 0,
+        .writing_track = null,
+        .write_buffer = track_data[slots.len * track_len ..][0..track_len],
+        .write_error = null,
+        .stopping = false,
+        .thread = undefined,
+        .stats = .{},
+    };
+    self.thread = try std.Thread.spawn(.{}, writeBack, .{self});
+}
+
+/// Write back all dirty tracks and stop the background thread.
+pub fn deinit(self: *SectorDevice) void {
+    self.flush() catch |err| {
+        log.err("Unable to write back tracks: {t}", .{err});
+    };
+    self.mutex.lockUncancelable(self.io);
+    self.stopping = true;
+    self.work.signal(self.io);
+    self.mutex.unlock(self.io);
+    self.thread.join();
+
+    self.gpa.free(self.track_slots);
+    self.gpa.free(self.track_data);
+    self.gpa.free(self.slots);
+    self.* = undefined;
+}
+
+/// Size of each raw sector on `track`, including any header and checksum.
+pub fn sectorSize(self: *const SectorDevice, track: u16) u16 {
+    return self.image_type.sectorSizeRawForTrack(track);
+}
+
+/// Copy the raw sector at `location` into `buffer`, which must be exactly sectorSize() bytes.
+pub fn readSector(self: *SectorDevice, location: PhysicalAddress, buffer: []u8) Error!void {
+    const offset = try self.offsetInTrack(location, buffer.len);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    const slot = try self.cachedTrack(location.track);
+    @memcpy(buffer, slot.data[offset..][0..buffer.len]);
+}
+
+/// Copy `data`, which must be exactly sectorSize() bytes, to the raw sector at `location`.
+/// The track is written back to the image in the background.
+pub fn writeSector(self: *SectorDevice, location: PhysicalAddress, data: []const u8) Error!void {
+    const offset = try self.offsetInTrack(location, data.len);
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    const slot = try self.cachedTrack(location.track);
+    @memcpy(slot.data[offset..][0..data.len], data);
+    if (!slot.dirty) {
+        slot.dirty = true;
+        self.dirty_count += 1;
+        self.work.signal(self.io);
+    }
+}
+
+/// Wait until every dirty track has been written back to the image.
+/// Returns any error from writing back tracks since the last flush().
+pub fn flush(self: *SectorDevice) Error!void {
+    self.mutex.lockUncancelable(self.io);
+    defer self.mutex.unlock(self.io);
+    while (self.dirty_count > 0 or self.writing_track != null) {
+        self.work.signal(self.io);
+        self.written.waitUncancelable(self.io, &self.mutex);
+    }
+    if (self.write_error) |err| {
+        self.write_error = null;
+        return err;
+    }
+}
+
+/// Offset of the sector at `location` from the start of its track in the image.
+fn offsetInTrack(self: *const SectorDevice, location: PhysicalAddress, len: usize) Error!usize {
+    try location.validate(self.image_type);
+    const sector_size = self.image_type.sectorSizeRawForTrack(location.track);
+    if (len != sector_size) return error.InvalidSectorSize;
+    if (!self.skew) return @as(usize, location.sector) * sector_size;
+    return self.image_type.sectorOffset(location) - trackOffset(self.image_type, location.track);
+}
+
+/// The slot holding `track`, reading it into the least recently used slot if it isn't cached.
+/// Must be called with the mutex held.
+fn cachedTrack(self: *SectorDevice, track: u16) Error!*Slot {
+    self.clock += 1;
+    const index = self.track_slots[track];
+    if (index != no_slot) {
+        const slot = &self.slots[index];
+        slot.last_used = self.clock;
+        self.stats.hits += 1;
+        return slot;
+    }
+    self.stats.misses += 1;
+
+    const slot_index = try self.evictLeastRecentlyUsed();
+    const slot = &self.slots[slot_index];
+    const data = slot.data[0..trackLength(self.image_type, track)];
+    const nbytes = try self.file.readPositionalAll(self.io, data, trackOffset(self.image_type, track));
+    if (nbytes < data.len) return error.EndOfStream;
+    slot.track = track;
+    slot.last_used = self.clock;
+    self.track_slots[track] = slot_index;
+    return slot;
+}
+
+/// Empty the least recently used slot, writing its track back first if it is dirty.
+/// Returns the index of the slot.
+fn evictLeastRecentlyUsed(self: *SectorDevice) Error!u16 {
+    while (true) {
+        var victim_index: u16 = 0;
+        for (self.slots, 0..) |*slot, i| {
+            if (slot.track == null) {
+                victim_index = @intCast(i);
+                break;
+            }
+            if (slot.last_used < self.slots[victim_index].last_used) victim_index = @intCast(i);
+        }
+        const victim = &self.slots[victim_index];
+        const track = victim.track orelse return victim_index;
+        // The background thread may be writing an older copy of the track, which must land first.
+        if (self.writing_track == track) {
+            self.written.waitUncancelable(self.io, &self.mutex);
+            continue;
+        }
+        if (victim.dirty) {
+            try self.writeTrack(track, victim.data[0..trackLength(self.image_type, track)]);
+            victim.dirty = false;
+            self.dirty_count -= 1;
+            self.stats.evictions += 1;
+            // flush() may be waiting for the last dirty track.
+            self.written.broadcast(self.io);
+        }
+        self.track_slots[track] = no_slot;
+        victim.track = null;
+        return victim_index;
+    }
+}
+
+/// Body of the background thread. Writes back one dirty track at a time, from a copy
+/// taken with the mutex held, so reads and writes can carry on while the track is written.
+fn writeBack(self: *SectorDevice) void {
+    const io = self.io;
+    self.mutex.lockUncancelable(io);
+    defer self.mutex.unlock(io);
+    while (true) {
+        while (self.dirty_count == 0 and !self.stopping) self.work.waitUncancelable(io, &self.mutex);
+        if (self.dirty_count == 0) return;
+
+        const slot = for (self.slots) |*slot| {
+            if (slot.dirty) break slot;
+        } else unreachable;
+        const track = slot.track.?;
+        const data = self.write_buffer[0..trackLength(self.image_type, track)];
+        @memcpy(data, slot.data[0..data.len]);
+        slot.dirty = false;
+        self.dirty_count -= 1;
+        self.writing_track = track;
+
+        self.mutex.unlock(io);
+        const result = self.writeTrack(track, data);
+        self.mutex.lockUncancelable(io);
+
+        self.writing_track = null;
+        self.stats.writebacks += 1;
+        result catch |err| {
+            log.err("Unable to write back track {d}: {t}", .{ track, err });
+            if (self.write_error == null) self.write_error = err;
+        };
+        self.written.broadcast(io);
+    }
+}
+
+fn writeTrack(self: *SectorDevice, track: u16, data: []const u8) std.Io.File.WritePositionalError!void {
+    try self.file.writePositionalAll(self.io, data, trackOffset(self.image_type, track));
+}
+
+fn trackOffset(image_type: *const DiskImageType, track: u16) usize {
+    return image_type.seekOffset(.{ .track = track, .sector = 0 });
+}
+
+fn trackLength(image_type: *const DiskImageType, track: u16) usize {
+    return @as(usize, image_type.sectorsForTrack(track)) * image_type.sectorSizeRawForTrack(track);
+}
+
+const std = @import("std");
+const log = std.log.scoped(.altair_disk_lib);
+const disk_types = @import("disk_types.zig");
+const DiskImageType = disk_types.DiskImageType;
+const PhysicalAddress = disk_types.PhysicalAddress;
@@ -0,0 +1,149 @@
+//! Write a ustar format tar archive as a stream.
+//! Unlike std.tar.Writer, the file contents are written by the caller straight to the
+//! underlying writer, between writeFileHeader() and endFile(), so nothing needs to be buffered.
+
+const block_size = 512;
+
+underlying_writer: *std.Io.Writer,
+
+const TarWriter = @This();
+
+pub fn init(underlying_writer: *std.Io.Writer) TarWriter {
+    return .{ .underlying_writer = underlying_writer };
+}
+
+/// Write a pax global header with the given `keyword=value` records.
+/// The records apply to all files that follow.
+pub fn writeGlobalHeader(self: *TarWriter, records: []const [2][]const u8) !void {
+    var size: usize = 0;
+    for (records) |record| size += recordLen(record[0], record[1]);
+    try self.writeHeader("pax_global_header", size, 0, 'g');
+    for (records) |record| {
+        try self.underlying_writer.print("{d} {s}={s}\n", .{ recordLen(record[0], record[1]), record[0], record[1] });
+    }
+    try self.endFile(size);
+}
+
+/// Write the header for a regular file of `size` bytes.
+/// Exactly `size` bytes must then be written to the underlying writer, followed by endFile()
+pub fn writeFileHeader(self: *TarWriter, path: []const u8, size: u64, mtime: u64) !void {
+    try self.writeHeader(path, size, mtime, '0');
+}
+
+/// Pad the contents of a file of `size` bytes to a whole block.
+pub fn endFile(self: *TarWriter, size: u64) std.Io.Writer.Error!void {
+    const padding: usize = @intCast((block_size - size % block_size) % block_size);
+    try self.underlying_writer.splatByteAll(0, padding);
+}
+
+/// Start the contents of a file of `size` bytes, after writeFileHeader().
+/// Writing through the returned writer keeps the archive valid if the contents turn out shorter or longer than `size`.
+pub fn fileWriter(self: *TarWriter, size: u64, buffer: []u8) FileWriter {
+    return .{
+        .underlying_writer = self.underlying_writer,
+        .size = size,
+        .written = 0,
+        .too_long = false,
+        .interface = .{ .vtable = &.{ .drain = FileWriter.drain }, .buffer = buffer },
+    };
+}
+
+/// Finish a file written through `file_writer`. If fewer than its `size` bytes were written,
+/// e.g. because the copy failed part way, the rest of the contents are zeros.
+pub fn endFileWriter(self: *TarWriter, file_writer: *FileWriter) std.Io.Writer.Error!void {
+    try file_writer.interface.flush();
+    try self.underlying_writer.splatByteAll(0, @intCast(file_writer.size - file_writer.written));
+    try self.endFile(file_writer.size);
+}
+
+/// Passes at most `size` bytes on to the underlying writer. See fileWriter()
+pub const FileWriter = struct {
+    underlying_writer: *std.Io.Writer,
+    size: u64,
+    written: u64,
+    /// Set if more than `size` bytes were written. The excess is dropped and the write fails.
+    too_long: bool,
+    interface: std.Io.Writer,
+
+    fn drain(w: *std.Io.Writer, data: []const []const u8, splat: usize) std.Io.Writer.Error!usize {
+        const self: *FileWriter = @alignCast(@fieldParentPtr("interface", w));
+        try self.pass(w.buffered());
+        w.end = 0;
+        var consumed: usize = 0;
+        for (data[0 .. data.len - 1]) |bytes| {
+            try self.pass(bytes);
+            consumed += bytes.len;
+        }
+        const pattern = data[data.len - 1];
+        for (0..splat) |_| try self.pass(pattern);
+        return consumed + pattern.len * splat;
+    }
+
+    fn pass(self: *FileWriter, bytes: []const u8) std.Io.Writer.Error!void {
+        const len: usize = @intCast(@min(bytes.len, self.size - self.written));
+        try self.underlying_writer.writeAll(bytes[0..len]);
+        self.written += len;
+        if (len < bytes.len) {
+            self.too_long = true;
+            // Drop anything still buffered, so that endFileWriter() can finish the file.
+            self.interface.end = 0;
+            return error.WriteFailed;
+        }
+    }
+};
+
+/// Write the two empty blocks that mark the end of the archive.
+pub fn finish(self: *TarWriter) std.Io.Writer.Error!void {
+    try self.underlying_writer.splatByteAll(0, 2 * block_size);
+}
+
+fn writeHeader(self: *TarWriter, path: []const u8, size: u64, mtime: u64, type_flag: u8) !void {
+    var header: [block_size]u8 = @splat(0);
+    if (path.len > 100) return error.NameTooLong;
+    @memcpy(header[0..path.len], path);
+    writeOctal(header[100..108], 0o644);
+    writeOctal(header[108..116], 0);
+    writeOctal(header[116..124], 0);
+    writeOctal(header[124..136], size);
+    writeOctal(header[136..148], mtime);
+    header[156] = type_flag;
+    @memcpy(header[257..265], "ustar\x0000");
+
+    // The checksum is calculated with the checksum field set to spaces.
+    @memset(header[148..156], ' ');
+    var checksum: u32 = 0;
+    for (header) |byte| checksum += byte;
+    writeOctal(header[148..155], checksum);
+
+    try self.underlying_writer.writeAll(&header);
+}
+
+/// Zero padded and NUL terminated octal, as used by all the numeric header fields.
+fn writeOctal(field: []u8, value: u64) void {
+    _ = std.fmt.bufPrint(field[0 .. field.len - 1], "{[value]o:0>[width]}", .{ .value = value, .width = field.len - 1 }) catch unreachable;
+    field[field.len - 1] = 0;
+}
+
+/// Length of the pax record "<len> <keyword>=<value>\n", which includes the digits of its own length.
+fn recordLen(keyword: []const u8, value: []const u8) usize {
+    const len = keyword.len + value.len + 3;
+    var digits: usize = 1;
+    while (std.math.pow(usize, 10, digits) <= len + digits) digits += 1;
+    return len + digits;
+}
+
+/// Seconds since the Unix epoch of a 19yy-mm-dd date.
+pub fn mtimeFromDate(yymmdd: [3]u8) u64 {
+    // Days from civil algorithm, for dates after 1970.
+    const year: u64 = 1900 + @as(u64, yymmdd[0]) - @intFromBool(yymmdd[1] <= 2);
+    const month: u64 = @max(yymmdd[1], 1);
+    const day: u64 = @max(yymmdd[2], 1);
+    const era = year / 400;
+    const year_of_era = year - era * 400;
+    const day_of_year = (153 * ((month + 9) % 12) + 2) / 5 + day - 1;
+    const day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    const days = era * 146097 + day_of_era -| 719468;
+    return days * std.time.s_per_day;
+}
+
+const std = @import("std");
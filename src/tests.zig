@@ -10,6 +10,7 @@ const RawCpmDirEntry = @import("os_cpm.zig").DirEntry;
 comptime {
     _ = @import("disk_image_tests.zig");
     _ = @import("basic_file_decoder.zig");
+    _ = @import("c_api.zig");
 }
 
 test "simple filename" {
@@ -0,0 +1,26 @@
+//! Run a set of workers, each on its own thread, and wait for them all to finish.
+//! Workers share out their tasks themselves, e.g. by taking the next index from an atomic counter.
+
+/// Number of workers to use for `task_count` tasks: `jobs` if set, otherwise one per CPU.
+pub fn count(jobs: ?u16, task_count: usize) usize {
+    const wanted: usize = jobs orelse std.Thread.getCpuCount() catch 1;
+    return @min(@max(wanted, 1), task_count);
+}
+
+/// Call `worker.run()` for every worker. The last worker runs on the calling thread.
+/// Returns once all the workers have returned.
+pub fn runAll(gpa: std.mem.Allocator, comptime Worker: type, workers: []Worker) (std.Thread.SpawnError || error{OutOfMemory})!void {
+    if (workers.len == 0) return;
+    const threads = try gpa.alloc(std.Thread, workers.len - 1);
+    defer gpa.free(threads);
+
+    var spawned: usize = 0;
+    defer for (threads[0..spawned]) |thread| thread.join();
+    for (threads, workers[0..threads.len]) |*thread, *worker| {
+        thread.* = try std.Thread.spawn(.{}, Worker.run, .{worker});
+        spawned += 1;
+    }
+    workers[workers.len - 1].run();
+}
+
+const std = @import("std");